@@ -0,0 +1,230 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace chrono;
+
+/// Gerador de carga para o planejador-servidor: abre varias conexoes, mantem
+/// em cada uma ateh "profundidade" pedidos em andamento (pipelining) e mede a
+/// vazao e a distribuicao das latencias das respostas.
+
+/// Resultado das consultas de uma conexao
+struct Medidas
+{
+  vector<double> latencia; // Em microssegundos
+  long sem_caminho;        // Respostas com comprimento <0
+  long erros;              // Respostas ERRO ou mal formadas
+  bool falhou;             // A conexao caiu antes do fim
+
+  Medidas(): latencia(), sem_caminho(0), erros(0), falhou(false) {}
+};
+
+/// Leh as ids dos pontos de um arquivo de pontos
+static vector<string> lerIds(const string& arq_pontos)
+{
+  vector<string> ids;
+  ifstream arq(arq_pontos);
+  string linha;
+  getline(arq, linha); // Cabecalho
+  while (getline(arq, linha))
+  {
+    size_t fim = linha.find(';');
+    if (fim != string::npos && fim > 0) ids.push_back(linha.substr(0, fim));
+  }
+  return ids;
+}
+
+/// Abre uma conexao com o servidor. Retorna -1 em caso de erro.
+static int conectar(const string& caminho_socket)
+{
+  sockaddr_un endereco;
+  memset(&endereco, 0, sizeof(endereco));
+  endereco.sun_family = AF_UNIX;
+  strncpy(endereco.sun_path, caminho_socket.c_str(), sizeof(endereco.sun_path)-1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  if (connect(fd, reinterpret_cast<sockaddr*>(&endereco), sizeof(endereco)) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/// Envia todos os dados. Retorna false em caso de erro.
+static bool enviarTudo(int fd, const string& S)
+{
+  size_t enviado = 0;
+  while (enviado < S.size())
+  {
+    ssize_t n = send(fd, S.data()+enviado, S.size()-enviado, MSG_NOSIGNAL);
+    if (n < 0)
+    {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    enviado += n;
+  }
+  return true;
+}
+
+/// Executa "total" consultas em uma conexao, com ateh "profundidade" pedidos em andamento
+static void executarConexao(const string& caminho_socket, const vector<string>& ids,
+                            long total, int profundidade, unsigned semente, Medidas& M)
+{
+  int fd = conectar(caminho_socket);
+  if (fd < 0)
+  {
+    M.falhou = true;
+    return;
+  }
+
+  mt19937 gerador(semente);
+  uniform_int_distribution<size_t> sorteio(0, ids.size()-1);
+  // Instante de envio de cada pedido: a id do pedido eh o indice neste vetor
+  vector<steady_clock::time_point> envio(total);
+  M.latencia.reserve(total);
+
+  long enviados = 0, recebidos = 0;
+  string saida, entrada;
+  char buffer[65536];
+  while (recebidos < total)
+  {
+    // Completa a janela de pedidos em andamento
+    saida.clear();
+    auto agora = steady_clock::now();
+    while (enviados < total && enviados - recebidos < profundidade)
+    {
+      saida += to_string(enviados);
+      saida += ' ';
+      saida += ids[sorteio(gerador)];
+      saida += ' ';
+      saida += ids[sorteio(gerador)];
+      saida += '\n';
+      envio[enviados++] = agora;
+    }
+    if (!saida.empty() && !enviarTudo(fd, saida))
+    {
+      M.falhou = true;
+      break;
+    }
+
+    // Recebe respostas
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n <= 0)
+    {
+      if (n < 0 && errno == EINTR) continue;
+      M.falhou = true;
+      break;
+    }
+    agora = steady_clock::now();
+    entrada.append(buffer, n);
+    size_t ini = 0, fim;
+    while ((fim = entrada.find('\n', ini)) != string::npos)
+    {
+      // "<id> <comprimento> ..." ou "<id> ERRO"
+      size_t esp = entrada.find(' ', ini);
+      long id = -1;
+      if (esp < fim)
+      {
+        try
+        {
+          id = stol(entrada.substr(ini, esp-ini));
+        }
+        catch (...) {}
+      }
+      if (id < 0 || id >= enviados)
+      {
+        ++M.erros;
+      }
+      else
+      {
+        M.latencia.push_back(duration<double,micro>(agora - envio[id]).count());
+        if (entrada.compare(esp+1, 4, "ERRO") == 0) ++M.erros;
+        else if (entrada[esp+1] == '-') ++M.sem_caminho;
+      }
+      ++recebidos;
+      ini = fim + 1;
+    }
+    entrada.erase(0, ini);
+  }
+  close(fd);
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 3)
+  {
+    cerr << "Uso: " << argv[0]
+         << " <socket> <arq_pontos> [conexoes=4] [profundidade=32] [pedidos=100000]\n";
+    return -1;
+  }
+  string caminho_socket = argv[1];
+  int conexoes = (argc > 3 ? stoi(argv[3]) : 4);
+  int profundidade = (argc > 4 ? stoi(argv[4]) : 32);
+  long pedidos = (argc > 5 ? stol(argv[5]) : 100000);
+
+  vector<string> ids = lerIds(argv[2]);
+  if (ids.empty())
+  {
+    cerr << "Erro na leitura do arquivo de pontos " << argv[2] << endl;
+    return -1;
+  }
+
+  // Uma thread por conexao
+  vector<Medidas> medidas(conexoes);
+  vector<thread> threads;
+  auto t1 = steady_clock::now();
+  for (int i=0; i<conexoes; ++i)
+  {
+    long total = pedidos/conexoes + (i < pedidos%conexoes ? 1 : 0);
+    threads.emplace_back(executarConexao, cref(caminho_socket), cref(ids),
+                         total, profundidade, 1000u+i, ref(medidas[i]));
+  }
+  for (auto& T : threads) T.join();
+  auto t2 = steady_clock::now();
+
+  // Junta as medidas das conexoes
+  vector<double> latencia;
+  long sem_caminho = 0, erros = 0;
+  bool falhou = false;
+  for (auto& M : medidas)
+  {
+    latencia.insert(latencia.end(), M.latencia.begin(), M.latencia.end());
+    sem_caminho += M.sem_caminho;
+    erros += M.erros;
+    falhou = falhou || M.falhou;
+  }
+  if (falhou) cerr << "Aviso: alguma conexao falhou antes do fim\n";
+  if (latencia.empty()) return -1;
+  sort(latencia.begin(), latencia.end());
+  auto percentil = [&latencia](double p)
+  {
+    return latencia[min(latencia.size()-1, size_t(p*latencia.size()))];
+  };
+  double tempo = duration<double>(t2 - t1).count();
+  double media = 0.0;
+  for (double L : latencia) media += L;
+  media /= latencia.size();
+
+  cout << "Respostas: " << latencia.size() << " (sem caminho: " << sem_caminho
+       << ", erros: " << erros << ")\n";
+  cout << "Conexoes: " << conexoes << "  profundidade: " << profundidade << endl;
+  cout << "Tempo: " << tempo << "s  vazao: " << latencia.size()/tempo << " consultas/s\n";
+  cout << "Latencia (us): media " << media
+       << "  p50 " << percentil(0.50) << "  p90 " << percentil(0.90)
+       << "  p99 " << percentil(0.99) << "  p99.9 " << percentil(0.999)
+       << "  max " << latencia.back() << endl;
+  return 0;
+}
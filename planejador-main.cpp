@@ -9,8 +9,8 @@ int main()
   // O planejador de caminhos
   Planejador G;
   // O caminho a ser calculado:
-  // Os pontos do caminho
-  Caminho C;
+  // As etapas do caminho (handles das rotas e dos pontos)
+  CaminhoCompacto C;
   // O numero de nohs gerados no calculo do caminho
   int NA(-1),NF(-1);
   // O comprimento do caminho calculado
@@ -26,8 +26,6 @@ int main()
 
   // Variaveis auxiliares
   IDPonto id_origem, id_destino;
-  Rota R;
-  Ponto P;
   string S;
 
   int opcao;
@@ -37,13 +35,14 @@ int main()
     cout << "1 - Imprimir pontos\n";
     cout << "2 - Imprimir rotas\n";
     cout << "3 - Calcular e imprimir caminho\n";
+    cout << "4 - Imprimir componentes conexos\n";
     cout << "0 - Sair\n";
     do
     {
       cout << "OPCAO: ";
       cin >> opcao;
     }
-    while (opcao<0 || opcao>3);
+    while (opcao<0 || opcao>4);
     switch(opcao)
     {
     case 1:
@@ -104,25 +103,15 @@ int main()
       {
         // Imprime as etapas do caminho
         cout << "==========\n";
-        for (auto par : C)
-        {
-          if (par.first == IDRota())
-          {
-            cout << "De ";
-          }
-          else
-          {
-            R = G.getRota(par.first);
-            cout << "Por " << R.nome << " ateh ";
-          }
-          P = G.getPonto(par.second);
-          cout << P.nome;
-          if (par.first != IDRota()) cout << " (" << R.comprimento << "km)";
-          cout << endl;
-        }
+        C.escrever(cout);
+        cout.flush();
       }
 
 
+      break;
+    case 4:
+      cout << "COMPONENTES: " << G.numComponentes() << endl;
+      G.imprimirComponentes();
       break;
     case 0:
     default:
@@ -0,0 +1,513 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <charconv>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "planejador.h"
+
+using namespace std;
+
+/// Servidor de consultas de caminhos em um socket Unix local.
+/// O mapa eh lido uma unica vez e as consultas sao atendidas por threads de calculo.
+///
+/// Protocolo: uma mensagem por linha, com campos separados por espacos.
+///   pedido:   <id> <origem> <destino> [<prazo>]
+///   resposta: <id> <comprimento> <NA> <NF> <origem> [<rota> <ponto>]...
+/// <id> eh um texto sem espacos escolhido pelo cliente. Os pedidos de uma conexao
+/// podem ser enviados sem esperar as respostas anteriores, e as respostas voltam
+/// na ordem em que os calculos terminam, identificadas pelo <id>.
+/// Comprimento, NA e NF seguem Planejador::calculaCaminho (<0 se parametros
+/// invalidos ou se nao existe caminho). Um pedido mal formado recebe "<id> ERRO".
+/// O <prazo> opcional, em milissegundos, conta a partir da chegada do pedido: se
+/// terminar antes do fim do calculo, a resposta eh "<id> EXPIRADO". Um prazo maior
+/// que o relogio comporta (PRAZO_MAXIMO, cerca de 292 anos) equivale a nao ter prazo. Os pedidos em
+/// andamento de uma conexao que foi fechada sao cancelados. Uma linha maior que
+/// LIMITE_LINHA fecha a conexao.
+
+/// Limite de dados de resposta ainda nao enviados de uma conexao.
+/// Acima dele, o servidor para de ler pedidos dessa conexao.
+static const size_t LIMITE_SAIDA = 1<<20;
+
+/// Tamanho maximo de uma linha de pedido. Um cliente que envia uma linha maior
+/// (ou que nunca envia '\n') tem a conexao fechada.
+static const size_t LIMITE_LINHA = 1<<16;
+
+/// Maior prazo de pedido, em milissegundos, representavel no relogio das consultas
+static const long PRAZO_MAXIMO =
+  chrono::duration_cast<chrono::milliseconds>(Limites::Relogio::duration::max()).count();
+
+/// Identificadores dos descritores no epoll: as conexoes sao numeradas a partir de PRIMEIRA_CONEXAO
+static const uint64_t ID_ESCUTA = 0;
+static const uint64_t ID_EVENTO = 1;
+static const uint64_t PRIMEIRA_CONEXAO = 2;
+
+/// Indica que o servidor deve terminar (SIGINT ou SIGTERM)
+static volatile sig_atomic_t terminar = 0;
+
+static void tratarSinal(int)
+{
+  terminar = 1;
+}
+
+/// Um pedido de calculo de caminho, recebido por uma conexao
+struct Pedido
+{
+  uint64_t conexao;  // Conexao que fez o pedido
+  string id;         // Id do pedido, escolhida pelo cliente
+  IDPonto origem;
+  IDPonto destino;
+  Limites limites;   // Prazo do pedido e cancelamento da conexao
+};
+
+/// Uma resposta pronta para ser enviada a uma conexao
+struct Resposta
+{
+  uint64_t conexao;
+  string texto;
+};
+
+/// Fila de pedidos compartilhada entre o laco de eventos e as threads de calculo.
+/// Ao encerrar, as threads ainda atendem os pedidos restantes (os das conexoes
+/// fechadas sao concluidos como CANCELADO, sem calculo).
+using FilaPedidos = FilaBloqueante<Pedido>;
+
+/// Respostas calculadas pelas threads, a serem enviadas pelo laco de eventos.
+/// A cada resposta incluida, o eventfd avisa o laco de eventos.
+class FilaRespostas
+{
+private:
+  mutex mtx;
+  vector<Resposta> respostas;
+  int evfd;
+public:
+  explicit FilaRespostas(int fd): mtx(), respostas(), evfd(fd) {}
+
+  void incluir(Resposta&& R)
+  {
+    {
+      lock_guard<mutex> lock(mtx);
+      respostas.push_back(move(R));
+    }
+    uint64_t um = 1;
+    if (write(evfd, &um, sizeof(um)) < 0) {} // O contador do eventfd soh acumula avisos
+  }
+
+  /// Retira todas as respostas prontas
+  void retirarTodas(vector<Resposta>& R)
+  {
+    uint64_t cont;
+    if (read(evfd, &cont, sizeof(cont)) < 0) {} // Zera o contador de avisos
+    lock_guard<mutex> lock(mtx);
+    R.swap(respostas);
+  }
+};
+
+/// Acrescenta um numero ao final de um texto
+template<class T>
+static void acrescentar(string& S, T valor)
+{
+  char num[32];
+  auto res = to_chars(num, num+sizeof(num), valor);
+  S.append(num, res.ptr-num);
+}
+
+/// Calcula um pedido e monta o texto da resposta
+static string responder(const Planejador& G, const Pedido& P)
+{
+  string R = P.id;
+  R += ' ';
+
+  // Ids inexistentes: a resposta eh a mesma de calculaCaminho, sem a mensagem de erro
+  if (G.getHandle(P.origem) == HANDLE_NULO || G.getHandle(P.destino) == HANDLE_NULO)
+  {
+    R += "-1 -1 -1\n";
+    return R;
+  }
+
+  CaminhoCompacto C;
+  int NA, NF;
+  EstadoConsulta estado = G.calculaCaminho(P.origem, P.destino, C, NA, NF, Pesos(), P.limites);
+  if (estado == EstadoConsulta::EXPIRADA || estado == EstadoConsulta::CANCELADA)
+  {
+    // A resposta a um pedido cancelado nao chega a ser enviada: a conexao foi fechada
+    R += (estado == EstadoConsulta::EXPIRADA ? "EXPIRADO\n" : "CANCELADO\n");
+    return R;
+  }
+  acrescentar(R, C.custoTotal());
+  R += ' ';
+  acrescentar(R, NA);
+  R += ' ';
+  acrescentar(R, NF);
+  for (const auto& E : C)
+  {
+    if (!E.origem())
+    {
+      R += ' ';
+      R += E.idRota();
+    }
+    R += ' ';
+    R += E.idPonto();
+  }
+  R += '\n';
+  return R;
+}
+
+/// Thread de calculo: atende os pedidos da fila ateh que ela seja encerrada
+static void trabalhar(const Planejador& G, FilaPedidos& pedidos, FilaRespostas& respostas)
+{
+  Pedido P;
+  while (pedidos.retirar(P))
+  {
+    respostas.incluir(Resposta{P.conexao, responder(G, P)});
+  }
+}
+
+/// Uma conexao de cliente
+struct Conexao
+{
+  int fd;
+  string entrada;  // Dados recebidos ainda nao processados (linha incompleta)
+  string saida;    // Dados de resposta ainda nao enviados
+  size_t enviado;  // Quantos bytes de saida jah foram enviados
+  uint32_t eventos; // Eventos atualmente registrados no epoll
+  Cancelamento cancelamento; // Cancela os pedidos em andamento quando a conexao eh fechada
+  size_t em_andamento; // Pedidos enviados aas threads e ainda sem resposta
+  bool fim_entrada;    // O cliente encerrou o envio (EOF): nao ha mais pedidos a ler
+
+  Conexao(int f=-1): fd(f), entrada(), saida(), enviado(0), eventos(0), cancelamento(),
+    em_andamento(0), fim_entrada(false) {}
+};
+
+/// O laco de eventos do servidor: aceita conexoes, le pedidos e envia respostas
+class Servidor
+{
+private:
+  int epfd;
+  int escuta;
+  FilaPedidos& pedidos;
+  FilaRespostas& respostas;
+  unordered_map<uint64_t,Conexao> conexoes;
+  uint64_t proxima;
+
+  /// Registra no epoll os eventos de interesse de uma conexao: leitura, se o cliente
+  /// nao encerrou o envio e a saida pendente estiver abaixo do limite, e escrita,
+  /// se houver saida pendente
+  void atualizar(uint64_t num, Conexao& c)
+  {
+    size_t pendente = c.saida.size() - c.enviado;
+    uint32_t eventos = (!c.fim_entrada && pendente < LIMITE_SAIDA ? uint32_t(EPOLLIN) : 0u) |
+                       (pendente > 0 ? uint32_t(EPOLLOUT) : 0u);
+    if (eventos == c.eventos) return;
+    epoll_event ev;
+    ev.events = eventos;
+    ev.data.u64 = num;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c.fd, &ev);
+    c.eventos = eventos;
+  }
+
+  void fechar(uint64_t num)
+  {
+    auto itr = conexoes.find(num);
+    if (itr == conexoes.end()) return;
+    epoll_ctl(epfd, EPOLL_CTL_DEL, itr->second.fd, nullptr);
+    close(itr->second.fd);
+    itr->second.cancelamento.cancelar();
+    conexoes.erase(itr);
+  }
+
+  void aceitar()
+  {
+    int fd;
+    while ((fd = accept4(escuta, nullptr, nullptr, SOCK_NONBLOCK|SOCK_CLOEXEC)) >= 0)
+    {
+      uint64_t num = proxima++;
+      Conexao& c = conexoes[num];
+      c.fd = fd;
+      c.eventos = EPOLLIN;
+      epoll_event ev;
+      ev.events = EPOLLIN;
+      ev.data.u64 = num;
+      epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+  }
+
+  /// Envia o que for possivel da saida pendente. Retorna false se a conexao caiu ou
+  /// terminou: o cliente encerrou o envio e todos os seus pedidos foram respondidos.
+  bool enviar(uint64_t num, Conexao& c)
+  {
+    while (c.enviado < c.saida.size())
+    {
+      ssize_t n = send(c.fd, c.saida.data()+c.enviado, c.saida.size()-c.enviado, MSG_NOSIGNAL);
+      if (n < 0)
+      {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        if (errno == EINTR) continue;
+        return false;
+      }
+      c.enviado += n;
+    }
+    if (c.enviado == c.saida.size())
+    {
+      c.saida.clear();
+      c.enviado = 0;
+      if (c.fim_entrada && c.em_andamento == 0) return false;
+    }
+    atualizar(num, c);
+    return true;
+  }
+
+  /// Separa os pedidos completos (linhas) recebidos pela conexao
+  void processarEntrada(uint64_t num, Conexao& c)
+  {
+    size_t ini = 0, fim;
+    while ((fim = c.entrada.find('\n', ini)) != string::npos)
+    {
+      size_t tam = fim - ini;
+      if (tam > 0 && c.entrada[ini+tam-1] == '\r') --tam;
+      // Campos separados por espacos
+      vector<string> campos;
+      size_t i = ini, fim_linha = ini + tam;
+      while (i < fim_linha)
+      {
+        while (i < fim_linha && c.entrada[i] == ' ') ++i;
+        size_t j = i;
+        while (j < fim_linha && c.entrada[j] != ' ') ++j;
+        if (j > i) campos.emplace_back(c.entrada, i, j-i);
+        i = j;
+      }
+      ini = fim + 1;
+      if (campos.empty()) continue;
+
+      // Prazo opcional, em milissegundos (<0 se nao fornecido ou acima de PRAZO_MAXIMO)
+      bool valido = (campos.size() == 3 || campos.size() == 4);
+      long prazo = -1;
+      if (campos.size() == 4)
+      {
+        const string& S = campos[3];
+        auto res = from_chars(S.data(), S.data()+S.size(), prazo);
+        valido = (res.ec == errc() && res.ptr == S.data()+S.size() && prazo >= 0);
+        if (valido && prazo > PRAZO_MAXIMO) prazo = -1;
+      }
+      if (!valido)
+      {
+        c.saida += campos[0];
+        c.saida += " ERRO\n";
+        continue;
+      }
+      // Os limites sao criados jah com o token da conexao (o default criaria outro token)
+      Pedido P{num, move(campos[0]), IDPonto(), IDPonto(),
+               (prazo >= 0 ? Limites(chrono::milliseconds(prazo), c.cancelamento)
+                           : Limites(c.cancelamento))};
+      P.origem.set(move(campos[1]));
+      P.destino.set(move(campos[2]));
+      pedidos.incluir(move(P));
+      ++c.em_andamento;
+    }
+    c.entrada.erase(0, ini);
+  }
+
+  /// Le os dados disponiveis em uma conexao. Retorna false se a conexao terminou.
+  /// Se o cliente encerrar o envio (EOF), a conexao continua aberta ateh que todos
+  /// os seus pedidos sejam respondidos.
+  bool receber(uint64_t num, Conexao& c)
+  {
+    char buffer[65536];
+    while (true)
+    {
+      ssize_t n = recv(c.fd, buffer, sizeof(buffer), 0);
+      if (n == 0)
+      {
+        // A ultima linha pode nao terminar com '\n'
+        c.fim_entrada = true;
+        if (!c.entrada.empty())
+        {
+          c.entrada += '\n';
+          processarEntrada(num, c);
+        }
+        break;
+      }
+      if (n < 0)
+      {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        if (errno == EINTR) continue;
+        return false;
+      }
+      c.entrada.append(buffer, n);
+      processarEntrada(num, c);
+      // O que sobrou eh uma linha incompleta
+      if (c.entrada.size() > LIMITE_LINHA) return false;
+    }
+    // Respostas a pedidos mal formados
+    return enviar(num, c);
+  }
+
+  /// Entrega as respostas calculadas pelas threads as suas conexoes
+  void entregarRespostas()
+  {
+    vector<Resposta> prontas;
+    respostas.retirarTodas(prontas);
+    // Respostas de conexoes que jah foram fechadas sao descartadas
+    vector<uint64_t> alteradas;
+    for (auto& R : prontas)
+    {
+      auto itr = conexoes.find(R.conexao);
+      if (itr == conexoes.end()) continue;
+      if (itr->second.saida.empty()) alteradas.push_back(R.conexao);
+      itr->second.saida += R.texto;
+      --itr->second.em_andamento;
+    }
+    for (uint64_t num : alteradas)
+    {
+      auto itr = conexoes.find(num);
+      if (itr != conexoes.end() && !enviar(num, itr->second)) fechar(num);
+    }
+  }
+
+public:
+  Servidor(int ep, int esc, FilaPedidos& P, FilaRespostas& R):
+    epfd(ep), escuta(esc), pedidos(P), respostas(R), conexoes(), proxima(PRIMEIRA_CONEXAO) {}
+
+  /// Fecha as conexoes restantes, cancelando os seus pedidos: os que ainda estao na
+  /// fila terminam sem calcular o caminho
+  ~Servidor()
+  {
+    while (!conexoes.empty()) fechar(conexoes.begin()->first);
+  }
+
+  /// Executa o laco de eventos ateh receber um sinal de termino
+  void executar()
+  {
+    epoll_event eventos[256];
+    while (!terminar)
+    {
+      int n = epoll_wait(epfd, eventos, 256, -1);
+      if (n < 0)
+      {
+        if (errno == EINTR) continue;
+        cerr << "Erro no epoll_wait: " << strerror(errno) << endl;
+        return;
+      }
+      for (int i=0; i<n; ++i)
+      {
+        uint64_t num = eventos[i].data.u64;
+        if (num == ID_ESCUTA)
+        {
+          aceitar();
+        }
+        else if (num == ID_EVENTO)
+        {
+          entregarRespostas();
+        }
+        else
+        {
+          auto itr = conexoes.find(num);
+          if (itr == conexoes.end()) continue;
+          Conexao& c = itr->second;
+          bool ok = true;
+          if (eventos[i].events & (EPOLLERR|EPOLLHUP)) ok = false;
+          if (ok && (eventos[i].events & EPOLLOUT)) ok = enviar(num, c);
+          if (ok && (eventos[i].events & EPOLLIN)) ok = receber(num, c);
+          if (!ok) fechar(num);
+        }
+      }
+    }
+  }
+};
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    cerr << "Uso: " << argv[0] << " <socket> [arq_pontos arq_rotas [num_threads]]\n";
+    return -1;
+  }
+  string caminho_socket = argv[1];
+  string arq_pontos = (argc > 3 ? argv[2] : "pontos.txt");
+  string arq_rotas = (argc > 3 ? argv[3] : "rotas.txt");
+  unsigned num_threads = (argc > 4 ? stoi(argv[4]) : 0);
+  if (num_threads == 0) num_threads = max(thread::hardware_concurrency(), 1u);
+
+  // O mapa eh lido uma unica vez
+  Planejador G;
+  if (!G.lerParalelo(arq_pontos, arq_rotas))
+  {
+    cerr << "Erro na leitura dos arquivos do mapa\n";
+    return -1;
+  }
+
+  // Socket de escuta
+  sockaddr_un endereco;
+  memset(&endereco, 0, sizeof(endereco));
+  endereco.sun_family = AF_UNIX;
+  if (caminho_socket.size() >= sizeof(endereco.sun_path))
+  {
+    cerr << "Caminho do socket muito longo\n";
+    return -1;
+  }
+  strcpy(endereco.sun_path, caminho_socket.c_str());
+  int escuta = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+  unlink(caminho_socket.c_str());
+  if (escuta < 0 ||
+      bind(escuta, reinterpret_cast<sockaddr*>(&endereco), sizeof(endereco)) < 0 ||
+      listen(escuta, SOMAXCONN) < 0)
+  {
+    cerr << "Erro ao criar o socket " << caminho_socket << ": " << strerror(errno) << endl;
+    return -1;
+  }
+
+  // Termina de forma ordenada com SIGINT ou SIGTERM
+  struct sigaction acao;
+  memset(&acao, 0, sizeof(acao));
+  acao.sa_handler = tratarSinal;
+  sigaction(SIGINT, &acao, nullptr);
+  sigaction(SIGTERM, &acao, nullptr);
+
+  // epoll com o socket de escuta e o eventfd das respostas
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  int evfd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+  epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.u64 = ID_ESCUTA;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, escuta, &ev);
+  ev.data.u64 = ID_EVENTO;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, evfd, &ev);
+
+  // Threads de calculo
+  FilaPedidos pedidos;
+  FilaRespostas respostas(evfd);
+  vector<thread> threads;
+  for (unsigned i=0; i<num_threads; ++i)
+  {
+    threads.emplace_back(trabalhar, cref(G), ref(pedidos), ref(respostas));
+  }
+
+  cout << "Servidor pronto em " << caminho_socket << " ("
+       << G.numPontos() << " pontos, " << G.numRotas() << " rotas, "
+       << num_threads << " threads)" << endl;
+  {
+    Servidor S(epfd, escuta, pedidos, respostas);
+    S.executar();
+  }
+
+  // Termino
+  pedidos.encerrar();
+  for (auto& T : threads) T.join();
+  close(evfd);
+  close(epfd);
+  close(escuta);
+  unlink(caminho_socket.c_str());
+  return 0;
+}
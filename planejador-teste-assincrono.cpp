@@ -0,0 +1,274 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <future>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cmath>
+
+#include "planejador.h"
+
+using namespace std;
+using namespace chrono;
+
+/// Teste das consultas assincronas (ExecutorConsultas): confere os resultados com os
+/// das consultas sincronas e verifica que uma consulta expirada ou cancelada termina
+/// logo e libera a sua thread para as consultas seguintes da fila. Verifica tambem
+/// que um mapa movido fica vazio e pode ser consultado.
+/// Retorna 0 se todas as verificacoes passarem e 1 se alguma falhar.
+
+/// Numero de verificacoes que falharam
+static int falhas = 0;
+
+/// Registra o resultado de uma verificacao
+static void verificar(bool ok, const string& descricao)
+{
+  cout << (ok ? "OK     " : "FALHA  ") << descricao << endl;
+  if (!ok) ++falhas;
+}
+
+/// Nome de um estado de consulta
+static string nomeEstado(EstadoConsulta E)
+{
+  static const char* const NOMES[] = {"OK", "SEM_CAMINHO", "INVALIDA", "EXPIRADA", "CANCELADA"};
+  return NOMES[int(E)];
+}
+
+/// Tempo decorrido entre dois instantes, em milissegundos
+static double ms(steady_clock::time_point t1, steady_clock::time_point t2)
+{
+  return duration<double,milli>(t2 - t1).count();
+}
+
+/// Uma consulta entre dois pontos do mapa
+struct Par
+{
+  IDPonto origem;
+  IDPonto destino;
+};
+
+/// Id do ponto de handle h
+static IDPonto idDe(const Planejador& G, HandlePonto h)
+{
+  IDPonto id;
+  id.set(string(G.idPonto(h)));
+  return id;
+}
+
+/// Os resultados assincronos devem ser iguais aos sincronos, com e sem pesos
+static void testarResultados(const Planejador& G, const vector<Par>& pares, unsigned num_threads)
+{
+  ExecutorConsultas E(G, num_threads);
+  for (const Pesos& P : {Pesos(), Pesos(0.5, 1.0, 0.2, 0.1)})
+  {
+    vector<future<ResultadoConsulta>> F;
+    for (const Par& Q : pares) F.push_back(E.submeter(Q.origem, Q.destino, P));
+    int diferentes = 0;
+    for (size_t i=0; i<pares.size(); ++i)
+    {
+      ResultadoConsulta R = F[i].get();
+      CaminhoCompacto C;
+      int NA, NF;
+      double custo = G.calculaCaminho(pares[i].origem, pares[i].destino, C, NA, NF, P);
+      bool igual = (fabs(custo - R.custo()) <= 1e-9*max(1.0, fabs(custo)) &&
+                    NA == R.NA && NF == R.NF && C.size() == R.caminho.size());
+      if (!igual) ++diferentes;
+    }
+    verificar(diferentes == 0, to_string(pares.size()) + " consultas com pesos (" +
+              to_string(P.comprimento) + ", " + to_string(P.tempo) + ", " +
+              to_string(P.pedagio) + ", " + to_string(P.classe) + "): " +
+              to_string(diferentes) + " diferentes do sincrono");
+  }
+}
+
+/// Um mapa movido fica vazio: as consultas a ele falham normalmente, e ele pode
+/// receber outro mapa
+static void testarMovido(const Planejador& G, const Par& Q)
+{
+  Planejador A(G);
+  Planejador B(std::move(A));
+  streambuf* antigo = cerr.rdbuf(nullptr);
+  bool vazio = (A.numPontos() == 0 && A.numRotas() == 0 && !A.getPonto(Q.origem).valid() &&
+                A.getHandle(Q.origem) == HANDLE_NULO && A.calculaDistancia(Q.origem, Q.destino) < 0 &&
+                A.tamanhoRotulos() == 0);
+  cerr.clear();
+  cerr.rdbuf(antigo);
+  verificar(vazio, "mapa movido vazio e consultavel");
+
+  A = std::move(B);
+  bool igual = (A.numPontos() == G.numPontos() && B.numPontos() == 0 &&
+                A.calculaDistancia(Q.origem, Q.destino) == G.calculaDistancia(Q.origem, Q.destino));
+  verificar(igual, "mapa movido de volta: mesma distancia do original");
+}
+
+/// Consultas invalidas, jah canceladas ou jah expiradas terminam sem busca
+static void testarEstados(const Planejador& G, const Par& Q, unsigned num_threads)
+{
+  ExecutorConsultas E(G, num_threads);
+  IDPonto inexistente;
+  inexistente.set("#ponto-inexistente");
+
+  // As mensagens de erro de calculaCaminho sao esperadas aqui
+  streambuf* antigo = cerr.rdbuf(nullptr);
+  ResultadoConsulta R1 = E.submeter(Q.origem, inexistente).get();
+  ResultadoConsulta R2 = E.submeter(Q.origem, Q.destino, Pesos(-1.0)).get();
+  cerr.clear();
+  cerr.rdbuf(antigo);
+  verificar(R1.estado == EstadoConsulta::INVALIDA, "id inexistente: " + nomeEstado(R1.estado));
+  verificar(R2.estado == EstadoConsulta::INVALIDA, "pesos negativos: " + nomeEstado(R2.estado));
+
+  Cancelamento K;
+  K.cancelar();
+  ResultadoConsulta R3 = E.submeter(Q.origem, Q.destino, Pesos(), Limites(K)).get();
+  verificar(R3.estado == EstadoConsulta::CANCELADA && R3.NF == 0,
+            "token jah cancelado: " + nomeEstado(R3.estado) + " (NF " + to_string(R3.NF) + ")");
+  ResultadoConsulta R4 = E.submeter(Q.origem, Q.destino, Pesos(), Limites(nanoseconds(0))).get();
+  verificar(R4.estado == EstadoConsulta::EXPIRADA && R4.NF == 0,
+            "prazo zero: " + nomeEstado(R4.estado) + " (NF " + to_string(R4.NF) + ")");
+}
+
+/// Uma consulta longa interrompida pelo prazo ou pelo cancelamento libera a unica
+/// thread do executor: a consulta curta seguinte termina bem antes do tempo que a
+/// longa levaria. duracao eh o tempo da consulta longa sincrona (ms).
+static void testarLiberacao(const Planejador& G, const Par& longa, double duracao)
+{
+  const Par curta = {longa.origem, longa.origem};
+  {
+    ExecutorConsultas E(G, 1);
+    auto t0 = steady_clock::now();
+    Limites L(microseconds(long(duracao*250)));
+    auto F1 = E.submeter(longa.origem, longa.destino, Pesos(), L);
+    auto F2 = E.submeter(curta.origem, curta.destino);
+    ResultadoConsulta R1 = F1.get();
+    auto t1 = steady_clock::now();
+    ResultadoConsulta R2 = F2.get();
+    auto t2 = steady_clock::now();
+    verificar(R1.estado == EstadoConsulta::EXPIRADA,
+              "prazo de 1/4 do tempo: " + nomeEstado(R1.estado) + " em " +
+              to_string(ms(t0, t1)) + " ms (atraso " + to_string(ms(L.prazo, t1)) + " ms)");
+    verificar(R2.estado == EstadoConsulta::OK && ms(t0, t2) < duracao/2,
+              "consulta seguinte: " + nomeEstado(R2.estado) + " em " + to_string(ms(t0, t2)) +
+              " ms (a longa leva " + to_string(duracao) + " ms)");
+  }
+  {
+    ExecutorConsultas E(G, 1);
+    Cancelamento K;
+    auto t0 = steady_clock::now();
+    auto F1 = E.submeter(longa.origem, longa.destino, Pesos(), Limites(K));
+    auto F2 = E.submeter(curta.origem, curta.destino);
+    this_thread::sleep_for(microseconds(long(duracao*250)));
+    auto tc = steady_clock::now();
+    K.cancelar();
+    ResultadoConsulta R1 = F1.get();
+    auto t1 = steady_clock::now();
+    ResultadoConsulta R2 = F2.get();
+    auto t2 = steady_clock::now();
+    verificar(R1.estado == EstadoConsulta::CANCELADA,
+              "cancelamento apos 1/4 do tempo: " + nomeEstado(R1.estado) + " " +
+              to_string(ms(tc, t1)) + " ms apos cancelar()");
+    verificar(R2.estado == EstadoConsulta::OK && ms(t0, t2) < duracao/2,
+              "consulta seguinte: " + nomeEstado(R2.estado) + " em " + to_string(ms(t0, t2)) +
+              " ms (a longa leva " + to_string(duracao) + " ms)");
+  }
+}
+
+/// Consultas que esperam na fila: o prazo pode terminar antes de haver uma thread
+/// livre, e as que restam quando o executor eh destruido sao concluidas como CANCELADA
+static void testarFila(const Planejador& G, const Par& longa, const Par& curta, double duracao)
+{
+  future<ResultadoConsulta> F3, F4;
+  {
+    ExecutorConsultas E(G, 1);
+    Cancelamento K;
+    auto F1 = E.submeter(longa.origem, longa.destino, Pesos(), Limites(K));
+    auto F2 = E.submeter(curta.origem, curta.destino, Pesos(), Limites(milliseconds(1)));
+    this_thread::sleep_for(microseconds(long(duracao*250)));
+    K.cancelar();
+    F1.get();
+    ResultadoConsulta R2 = F2.get();
+    verificar(R2.estado == EstadoConsulta::EXPIRADA && R2.NF == 0,
+              "prazo terminado na fila: " + nomeEstado(R2.estado) + " (NF " + to_string(R2.NF) + ")");
+
+    // Pendentes na destruicao: a longa em andamento eh cancelada antes
+    Cancelamento K2;
+    auto F5 = E.submeter(longa.origem, longa.destino, Pesos(), Limites(K2));
+    F3 = E.submeter(longa.origem, longa.destino);
+    F4 = E.submeter(curta.origem, curta.destino);
+    this_thread::sleep_for(milliseconds(2));
+    K2.cancelar();
+  }
+  ResultadoConsulta R3 = F3.get();
+  ResultadoConsulta R4 = F4.get();
+  verificar(R3.estado == EstadoConsulta::CANCELADA && R4.estado == EstadoConsulta::CANCELADA,
+            "pendentes na destruicao do executor: " + nomeEstado(R3.estado) + " " +
+            nomeEstado(R4.estado));
+}
+
+int main(int argc, char* argv[])
+{
+  string arq_pontos = (argc > 2 ? argv[1] : "pontos.txt");
+  string arq_rotas = (argc > 2 ? argv[2] : "rotas.txt");
+  unsigned num_threads = (argc > 3 ? stoi(argv[3]) : 2);
+
+  Planejador G;
+  if (!G.lerParalelo(arq_pontos, arq_rotas)) return 1;
+  const int NP = G.numPontos();
+  if (NP == 0)
+  {
+    cerr << "Mapa vazio\n";
+    return 1;
+  }
+
+  // Consultas aleatorias (sempre as mesmas)
+  mt19937 gerador(11);
+  uniform_int_distribution<int> ponto(0, NP-1);
+  vector<Par> pares;
+  for (int i=0; i<200; ++i) pares.push_back({idDe(G, ponto(gerador)), idDe(G, ponto(gerador))});
+
+  // Resultado e tempo sincronos de cada consulta. As verificacoes de estado e de tempo
+  // usam consultas com caminho: origem e destino em componentes conexos diferentes
+  // terminam como SEM_CAMINHO antes de os limites serem verificados.
+  vector<Par> com_caminho;
+  double duracao = 0.0;
+  Par longa = pares[0];
+  for (const Par& Q : pares)
+  {
+    CaminhoCompacto C;
+    int NA, NF;
+    auto t1 = steady_clock::now();
+    double custo = G.calculaCaminho(Q.origem, Q.destino, C, NA, NF);
+    double t = ms(t1, steady_clock::now());
+    if (custo < 0.0) continue;
+    com_caminho.push_back(Q);
+    if (t > duracao)
+    {
+      duracao = t;
+      longa = Q;
+    }
+  }
+  // Um ponto sempre tem caminho para si mesmo
+  while (com_caminho.size() < 2) com_caminho.push_back({pares[0].origem, pares[0].origem});
+
+  testarMovido(G, com_caminho[0]);
+  testarResultados(G, pares, num_threads);
+  testarEstados(G, com_caminho[0], num_threads);
+
+  // A consulta com caminho mais demorada entre as aleatorias, para as verificacoes de tempo
+  const double DURACAO_MINIMA = 20.0;
+  if (duracao < DURACAO_MINIMA)
+  {
+    cout << "AVISO  a consulta mais longa leva " << duracao << " ms: verificacoes de tempo "
+         << "omitidas (use um mapa maior)" << endl;
+  }
+  else
+  {
+    testarLiberacao(G, longa, duracao);
+    testarFila(G, longa, com_caminho[1], duracao);
+  }
+
+  cout << (falhas == 0 ? "Todas as verificacoes passaram" :
+           to_string(falhas) + " verificacao(oes) falharam") << endl;
+  return (falhas == 0 ? 0 : 1);
+}
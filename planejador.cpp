@@ -3,7 +3,12 @@
 #include <algorithm>
 #include <cmath>
 #include <vector>
-#include <stack>
+#include <charconv>
+#include <queue>
+#include <limits>
+#include <thread>
+#include <atomic>
+#include <cstring>
 
 #include "planejador.h"
 
@@ -35,19 +40,17 @@ void IDRota::set(string&& S)
    * CLASSE PONTO          *
    ************************* */
 
-/// Distancia entre 2 pontos (formula de haversine)
-double haversine(const Ponto& P1, const Ponto& P2)
+/// Distancia entre 2 pontos dadas as coordenadas em graus (formula de haversine)
+static double haversine(double latitude1, double longitude1,
+                        double latitude2, double longitude2)
 {
-    // Tratar logo pontos identicos
-    if (P1.id == P2.id) return 0.0;
-
     static const double MY_PI = 3.14159265358979323846;
     static const double R_EARTH = 6371.0;
     // Conversao para radianos
-    double lat1 = MY_PI*P1.latitude/180.0;
-    double lat2 = MY_PI*P2.latitude/180.0;
-    double lon1 = MY_PI*P1.longitude/180.0;
-    double lon2 = MY_PI*P2.longitude/180.0;
+    double lat1 = MY_PI*latitude1/180.0;
+    double lat2 = MY_PI*latitude2/180.0;
+    double lon1 = MY_PI*longitude1/180.0;
+    double lon2 = MY_PI*longitude2/180.0;
 
     double cosseno = sin(lat1)*sin(lat2) + cos(lat1)*cos(lat2)*cos(lon1-lon2);
     // Para evitar eventuais erros na funcao acos por imprecisao numerica
@@ -58,6 +61,237 @@ double haversine(const Ponto& P1, const Ponto& P2)
     return R_EARTH*acos(cosseno);
 }
 
+/// Distancia entre 2 pontos (formula de haversine)
+double haversine(const Ponto& P1, const Ponto& P2)
+{
+    // Tratar logo pontos identicos
+    if (P1.id == P2.id) return 0.0;
+
+    return haversine(P1.latitude, P1.longitude, P2.latitude, P2.longitude);
+}
+
+/// Executa funcao(i), para i = 0 ... N-1, cada uma em uma thread
+template<class Funcao>
+static void executarEmParalelo(unsigned N, const Funcao& funcao)
+{
+    vector<thread> threads;
+    for (unsigned i=1; i<N; ++i) threads.emplace_back(funcao, i);
+    funcao(0);
+    for (auto& T : threads) T.join();
+}
+
+/// Executa funcao(i), para i = 0 ... N-1, dividindo os valores de i em num_threads
+/// blocos consecutivos, cada um em uma thread
+template<class Funcao>
+static void executarEmBlocos(size_t N, unsigned num_threads, const Funcao& funcao)
+{
+    executarEmParalelo(num_threads, [&](unsigned t)
+    {
+        for (size_t i=N*t/num_threads; i<N*(t+1)/num_threads; ++i) funcao(i);
+    });
+}
+
+/* *************************
+   * CLASSE POOLTEXTOS     *
+   ************************* */
+
+/// Torna o conjunto vazio
+void PoolTextos::clear()
+{
+    dados.clear();
+    inicio.assign(1, 0);
+    partes.assign(NUM_PARTES, Parte());
+}
+
+/// Posicao do texto S, com hash h, na parte P: a que contem S ou a posicao livre
+/// onde S seria incluido. texto(i) eh o texto de indice i.
+template<class Texto>
+size_t PoolTextos::posicao(const Parte& P, size_t h, string_view S, const Texto& texto)
+{
+    const size_t mascara = P.tabela.size()-1;
+    size_t pos = (h / NUM_PARTES) & mascara;
+    while (P.tabela[pos] != 0 && texto(P.tabela[pos]-1) != S) pos = (pos+1) & mascara;
+    return pos;
+}
+
+/// Aumenta a parte P, reinserindo os seus textos, para que caibam nela ocupadas
+/// textos com no maximo 3/4 das posicoes ocupadas
+template<class Texto>
+void PoolTextos::aumentar(Parte& P, size_t ocupadas, const Texto& texto)
+{
+    size_t tamanho = 16;
+    while (4*ocupadas > 3*tamanho) tamanho *= 2;
+    if (tamanho <= P.tabela.size()) return;
+    vector<uint32_t> antiga(tamanho, 0);
+    antiga.swap(P.tabela);
+    const size_t mascara = P.tabela.size()-1;
+    for (uint32_t indice : antiga)
+    {
+        if (indice == 0) continue;
+        size_t pos = (hash<string_view>()(texto(indice-1)) / NUM_PARTES) & mascara;
+        while (P.tabela[pos] != 0) pos = (pos+1) & mascara;
+        P.tabela[pos] = indice;
+    }
+}
+
+/// Retorna o indice do texto S, incluindo-o se ainda nao existir.
+/// Retorna NAO_CABE, sem incluir, se S eh novo e nao cabe no conjunto.
+size_t PoolTextos::incluir(string_view S)
+{
+    auto texto = [this](uint32_t i)
+    {
+        return (*this)[i];
+    };
+    const size_t h = hash<string_view>()(S);
+    Parte& P = parte(h);
+    // Cada parte fica no maximo 3/4 ocupada
+    aumentar(P, P.ocupadas+1, texto);
+    size_t pos = posicao(P, h, S, texto);
+    if (P.tabela[pos] == 0)
+    {
+        if (!cabe(1, S.size())) return NAO_CABE;
+        dados.insert(dados.end(), S.begin(), S.end());
+        inicio.push_back(dados.size());
+        P.tabela[pos] = size();
+        ++P.ocupadas;
+    }
+    return P.tabela[pos]-1;
+}
+
+/// Coloca em indices o indice de cada texto de S, incluindo os que ainda nao
+/// existirem, na ordem de S. As partes da tabela de hash sao preenchidas em
+/// paralelo por num_threads threads.
+/// Retorna a posicao em S do primeiro texto que jah existia no conjunto ou que
+/// aparece antes em S (S.size() se nao houver repeticoes), ou NAO_CABE, sem
+/// incluir nenhum texto, se os textos novos nao cabem no conjunto.
+size_t PoolTextos::incluir(const vector<string_view>& S, vector<uint32_t>& indices,
+                           unsigned num_threads)
+{
+    const size_t N = S.size();
+    const uint32_t base = size();
+    // Os indices provisorios (abaixo) tambem precisam caber em 32 bits
+    if (N >= UINT32_MAX-base) return NAO_CABE;
+    indices.resize(N);
+    num_threads = min(num_threads, NUM_PARTES);
+
+    // Enquanto as partes sao preenchidas, o texto S[i] entra provisoriamente com o
+    // indice base+i, ainda sem ser copiado para o conjunto
+    auto texto = [this,&S,base](uint32_t i)
+    {
+        return (i < base ? (*this)[i] : S[i-base]);
+    };
+    vector<size_t> hashes(N);
+    executarEmBlocos(N, num_threads, [&](size_t i)
+    {
+        hashes[i] = hash<string_view>()(S[i]);
+    });
+
+    // Cada thread procura e inclui os textos das suas partes, na ordem de S.
+    // Textos iguais caem na mesma parte, entao as repeticoes sao todas encontradas.
+    // Antes, cada parte eh aumentada de uma vez para caber todos os seus textos de S.
+    vector<size_t> repetido(num_threads, N);
+    executarEmParalelo(num_threads, [&](unsigned t)
+    {
+        size_t novos[NUM_PARTES] = {};
+        for (size_t i=0; i<N; ++i) ++novos[hashes[i] % NUM_PARTES];
+        for (unsigned p=t; p<NUM_PARTES; p+=num_threads)
+        {
+            aumentar(partes[p], partes[p].ocupadas+novos[p], texto);
+        }
+        for (size_t i=0; i<N; ++i)
+        {
+            if (hashes[i] % NUM_PARTES % num_threads != t) continue;
+            Parte& P = parte(hashes[i]);
+            size_t pos = posicao(P, hashes[i], S[i], texto);
+            if (P.tabela[pos] == 0)
+            {
+                P.tabela[pos] = base+i+1;
+                ++P.ocupadas;
+                indices[i] = base+i;
+            }
+            else
+            {
+                indices[i] = P.tabela[pos]-1;
+                repetido[t] = min(repetido[t], i);
+            }
+        }
+    });
+
+    // Se os textos novos nao cabem, retira-os da tabela. Eles foram incluidos depois
+    // de todos os textos antigos, cujas posicoes nao dependem deles.
+    size_t novos = 0, caracteres = 0;
+    for (size_t i=0; i<N; ++i)
+    {
+        if (indices[i] != base+i) continue;
+        ++novos;
+        caracteres += S[i].size();
+    }
+    if (!cabe(novos, caracteres))
+    {
+        executarEmParalelo(num_threads, [&](unsigned t)
+        {
+            for (unsigned p=t; p<NUM_PARTES; p+=num_threads)
+            {
+                for (uint32_t& indice : partes[p].tabela)
+                {
+                    if (indice <= base) continue;
+                    indice = 0;
+                    --partes[p].ocupadas;
+                }
+            }
+        });
+        return NAO_CABE;
+    }
+
+    // Copia os textos novos para o conjunto, na ordem de S, e troca os indices
+    // provisorios pelos definitivos. Um texto repetido em S aponta para a sua
+    // primeira ocorrencia, que jah recebeu o indice definitivo.
+    for (size_t i=0; i<N; ++i)
+    {
+        if (indices[i] == base+i)
+        {
+            dados.insert(dados.end(), S[i].begin(), S[i].end());
+            inicio.push_back(dados.size());
+            indices[i] = size()-1;
+        }
+        else if (indices[i] >= base)
+        {
+            indices[i] = indices[indices[i]-base];
+        }
+    }
+    executarEmParalelo(num_threads, [&](unsigned t)
+    {
+        for (unsigned p=t; p<NUM_PARTES; p+=num_threads)
+        {
+            for (uint32_t& indice : partes[p].tabela)
+            {
+                if (indice > base) indice = indices[indice-1-base]+1;
+            }
+        }
+    });
+
+    return *min_element(repetido.begin(), repetido.end());
+}
+
+/// Retorna o indice do texto S, ou -1 se ele nao existir
+int PoolTextos::procurar(string_view S) const
+{
+    const size_t h = hash<string_view>()(S);
+    const Parte& P = partes[h % NUM_PARTES];
+    if (P.tabela.empty()) return -1;
+    return int(P.tabela[posicao(P, h, S, [this](uint32_t i)
+    {
+        return (*this)[i];
+    })]) - 1;
+}
+
+/// Libera a memoria reservada durante as inclusoes e nao usada
+void PoolTextos::ajustar()
+{
+    dados.shrink_to_fit();
+    inicio.shrink_to_fit();
+}
+
 /* *************************
    * CLASSE PLANEJADOR     *
    ************************* */
@@ -65,78 +299,489 @@ double haversine(const Ponto& P1, const Ponto& P2)
 /// Torna o mapa vazio
 void Planejador::clear()
 {
-    pontos.clear();
-    rotas.clear();
+    idsPontos.clear();
+    idsRotas.clear();
+    nomes.clear();
+    indNomePonto.clear();
+    indNomeRota.clear();
+    latitude.clear();
+    longitude.clear();
+    comprimento.clear();
+    extremidade[0].clear();
+    extremidade[1].clear();
+    tempo.clear();
+    pedagio.clear();
+    classe.clear();
+    // Indice vazio, como o de um mapa recem-criado: nao ha o que recalcular
+    razaoMinima[0] = razaoMinima[1] = razaoMinima[2] = razaoMinima[3] = 0.0;
+    inicioAdj.clear();
+    rotaAdj.clear();
+    vizinhoAdj.clear();
+    componente.clear();
+    componentes.clear();
+    inicioRotulo.clear();
+    rotulos.clear();
+    paresRotulos = 0;
 }
 
-/// Retorna um Ponto do mapa, passando a id como parametro.
-/// Se a id for inexistente, retorna um Ponto vazio.
-Ponto Planejador::getPonto(const IDPonto& Id) const // Eu preciso testar se ela  vlida?
+/// Inclui um ponto no final do mapa, sem refazer o indice.
+/// Retorna 0, 8 (sem incluir) se jah existe ponto com a mesma id ou ERRO_TEXTOS
+/// se a id ou o nome nao cabem: o mapa fica incompleto e deve ser descartado.
+int Planejador::incluir(const Ponto& P)
+{
+    const size_t N = idsPontos.size();
+    const size_t id = idsPontos.incluir(P.id.str());
+    if (id == PoolTextos::NAO_CABE) return ERRO_TEXTOS;
+    if (id != N) return 8;
+    const size_t nome = nomes.incluir(P.nome);
+    if (nome == PoolTextos::NAO_CABE) return ERRO_TEXTOS;
+    indNomePonto.push_back(nome);
+    latitude.push_back(P.latitude);
+    longitude.push_back(P.longitude);
+    return 0;
+}
+
+/// Inclui uma rota no final do mapa, sem refazer o indice.
+/// Retorna 0, 13 (sem incluir) se jah existe rota com a mesma id ou ERRO_TEXTOS
+/// se a id ou o nome nao cabem: o mapa fica incompleto e deve ser descartado.
+int Planejador::incluir(const RotaLida& R)
+{
+    const size_t N = idsRotas.size();
+    const size_t id = idsRotas.incluir(R.rota.id.str());
+    if (id == PoolTextos::NAO_CABE) return ERRO_TEXTOS;
+    if (id != N) return 13;
+    const size_t nome = nomes.incluir(R.rota.nome);
+    if (nome == PoolTextos::NAO_CABE) return ERRO_TEXTOS;
+    indNomeRota.push_back(nome);
+    comprimento.push_back(R.rota.comprimento);
+    extremidade[0].push_back(R.extremidade[0]);
+    extremidade[1].push_back(R.extremidade[1]);
+    tempo.push_back(R.rota.tempo);
+    pedagio.push_back(R.rota.pedagio);
+    classe.push_back(R.rota.classe);
+    return 0;
+}
+
+/// Inclui os pontos no final do mapa, na ordem do vetor, sem refazer o indice,
+/// usando num_threads threads. Retorna 0, 8 se algum ponto tem a mesma id de um
+/// ponto do mapa ou anterior no vetor ou ERRO_TEXTOS se as ids ou os nomes nao
+/// cabem: nos dois casos o mapa fica incompleto e deve ser descartado.
+int Planejador::incluir(const vector<const Ponto*>& P, unsigned num_threads)
+{
+    const size_t N = P.size();
+    const size_t base = latitude.size();
+
+    // Ids e nomes, com as repeticoes procuradas em paralelo
+    vector<string_view> textos(N);
+    vector<uint32_t> indices;
+    executarEmBlocos(N, num_threads, [&](size_t i)
+    {
+        textos[i] = P[i]->id.str();
+    });
+    const size_t repetido = idsPontos.incluir(textos, indices, num_threads);
+    if (repetido == PoolTextos::NAO_CABE) return ERRO_TEXTOS;
+    if (repetido != N) return 8;
+    executarEmBlocos(N, num_threads, [&](size_t i)
+    {
+        textos[i] = P[i]->nome;
+    });
+    if (nomes.incluir(textos, indices, num_threads) == PoolTextos::NAO_CABE) return ERRO_TEXTOS;
+    indNomePonto.insert(indNomePonto.end(), indices.begin(), indices.end());
+
+    // Demais colunas
+    latitude.resize(base+N);
+    longitude.resize(base+N);
+    executarEmBlocos(N, num_threads, [&](size_t i)
+    {
+        latitude[base+i] = P[i]->latitude;
+        longitude[base+i] = P[i]->longitude;
+    });
+    return 0;
+}
+
+/// Inclui as rotas no final do mapa, na ordem do vetor, sem refazer o indice,
+/// usando num_threads threads. Retorna 0, 13 se alguma rota tem a mesma id de uma
+/// rota do mapa ou anterior no vetor ou ERRO_TEXTOS se as ids ou os nomes nao
+/// cabem: nos dois casos o mapa fica incompleto e deve ser descartado.
+int Planejador::incluir(const vector<const RotaLida*>& R, unsigned num_threads)
 {
-    // Procura um ponto que corresponde aa Id do parametro
+    const size_t N = R.size();
+    const size_t base = comprimento.size();
+
+    // Ids e nomes, com as repeticoes procuradas em paralelo
+    vector<string_view> textos(N);
+    vector<uint32_t> indices;
+    executarEmBlocos(N, num_threads, [&](size_t i)
+    {
+        textos[i] = R[i]->rota.id.str();
+    });
+    const size_t repetido = idsRotas.incluir(textos, indices, num_threads);
+    if (repetido == PoolTextos::NAO_CABE) return ERRO_TEXTOS;
+    if (repetido != N) return 13;
+    executarEmBlocos(N, num_threads, [&](size_t i)
+    {
+        textos[i] = R[i]->rota.nome;
+    });
+    if (nomes.incluir(textos, indices, num_threads) == PoolTextos::NAO_CABE) return ERRO_TEXTOS;
+    indNomeRota.insert(indNomeRota.end(), indices.begin(), indices.end());
+
+    // Demais colunas, com as extremidades jah procuradas na leitura
+    comprimento.resize(base+N);
+    extremidade[0].resize(base+N);
+    extremidade[1].resize(base+N);
+    tempo.resize(base+N);
+    pedagio.resize(base+N);
+    classe.resize(base+N);
+    executarEmBlocos(N, num_threads, [&](size_t i)
+    {
+        comprimento[base+i] = R[i]->rota.comprimento;
+        extremidade[0][base+i] = R[i]->extremidade[0];
+        extremidade[1][base+i] = R[i]->extremidade[1];
+        tempo[base+i] = R[i]->rota.tempo;
+        pedagio[base+i] = R[i]->rota.pedagio;
+        classe[base+i] = R[i]->rota.classe;
+    });
+    return 0;
+}
 
-    // Testa se  uma ID vlida
-    if(Id.valid())
+/// Refaz o indice a partir das colunas do mapa
+void Planejador::indexar()
+{
+    const size_t NP = numPontos();
+    const size_t NR = numRotas();
+
+    // Os rotulos de hubs do mapa anterior deixam de valer
+    inicioRotulo.clear();
+    rotulos.clear();
+    paresRotulos = 0;
+
+    // Libera a memoria reservada durante as inclusoes
+    idsPontos.ajustar();
+    idsRotas.ajustar();
+    nomes.ajustar();
+    indNomePonto.shrink_to_fit();
+    indNomeRota.shrink_to_fit();
+    latitude.shrink_to_fit();
+    longitude.shrink_to_fit();
+    comprimento.shrink_to_fit();
+    extremidade[0].shrink_to_fit();
+    extremidade[1].shrink_to_fit();
+
+    // Atributos opcionais: soh ocupam memoria se algum for diferente de zero
+    if (all_of(tempo.begin(), tempo.end(), [](double x){ return x == 0.0; })) tempo.clear();
+    if (all_of(pedagio.begin(), pedagio.end(), [](double x){ return x == 0.0; })) pedagio.clear();
+    if (all_of(classe.begin(), classe.end(), [](unsigned char x){ return x == 0; })) classe.clear();
+    tempo.shrink_to_fit();
+    pedagio.shrink_to_fit();
+    classe.shrink_to_fit();
+    razaoMinima[0] = razaoMinima[1] = razaoMinima[2] = razaoMinima[3] = 0.0;
+    bool primeira = true;
+    for (size_t r=0; r<NR; ++r)
     {
-        // Cria um interator para uma lista de pontos
-        list<Ponto>::const_iterator itr;
-        // Procura o ID na lista de pontos
-        itr = find(pontos.begin(), pontos.end(), Id); // Em uma lista de pontos, procura uma ID (Ponto == ID)
+        // Menor custo de cada atributo por km em linha reta
+        const HandlePonto v0 = extremidade[0][r];
+        const HandlePonto v1 = extremidade[1][r];
+        double reta = haversine(latitude[v0], longitude[v0], latitude[v1], longitude[v1]);
+        if (v0 != v1 && reta > 0.0)
+        {
+            double razao[4] = {comprimento[r]/reta, tempoRota(r)/reta, pedagioRota(r)/reta,
+                               classeRota(r)*comprimento[r]/reta};
+            for (int i=0; i<4; ++i)
+            {
+                razaoMinima[i] = (primeira ? razao[i] : min(razaoMinima[i], razao[i]));
+            }
+            primeira = false;
+        }
+    }
 
-        // Em caso de sucesso, retorna o ponto encontrado
+    // Lista de adjacencia: as rotas de cada ponto ficam na mesma ordem das rotas do mapa,
+    // que eh a ordem em que o algoritmo A* gera os sucessores
+    inicioAdj.assign(NP+1, 0);
+    for (HandlePonto v : extremidade[0]) ++inicioAdj[v+1];
+    for (HandlePonto v : extremidade[1]) ++inicioAdj[v+1];
+    for (size_t v=0; v<NP; ++v) inicioAdj[v+1] += inicioAdj[v];
+    rotaAdj.resize(2*NR);
+    vizinhoAdj.resize(2*NR);
+    vector<int> pos(inicioAdj.begin(), inicioAdj.end()-1);
+    for (size_t r=0; r<NR; ++r)
+    {
+        const HandlePonto v0 = extremidade[0][r];
+        const HandlePonto v1 = extremidade[1][r];
+        rotaAdj[pos[v0]] = r;
+        vizinhoAdj[pos[v0]++] = v1;
+        rotaAdj[pos[v1]] = r;
+        vizinhoAdj[pos[v1]++] = v0;
+    }
 
-        if(itr!=pontos.end())  // Se itr != pontos.end() significa que algum ponto correspondente foi encontrado
+    // Componentes conexos, por union-find sobre as rotas
+    vector<int> raiz(NP), tamanho(NP, 1);
+    for (size_t v=0; v<NP; ++v) raiz[v] = v;
+    auto achar = [&raiz](int v)
+    {
+        while (raiz[v] != v)
+        {
+            raiz[v] = raiz[raiz[v]];
+            v = raiz[v];
+        }
+        return v;
+    };
+    for (size_t r=0; r<NR; ++r)
+    {
+        int a = achar(extremidade[0][r]);
+        int b = achar(extremidade[1][r]);
+        if (a == b) continue;
+        if (tamanho[a] < tamanho[b]) swap(a,b);
+        raiz[b] = a;
+        tamanho[a] += tamanho[b];
+    }
+    // Numera os componentes na ordem do primeiro ponto de cada um
+    componente.assign(NP, -1);
+    componentes.clear();
+    vector<int> numero(NP, -1);
+    for (size_t v=0; v<NP; ++v)
+    {
+        int a = achar(v);
+        if (numero[a] < 0)
         {
-            return *itr; // Retorna a desreferenciao do iterator
+            numero[a] = componentes.size();
+            componentes.push_back(Componente(v));
         }
+        componente[v] = numero[a];
+        ++componentes[numero[a]].num_pontos;
+    }
+    for (size_t r=0; r<NR; ++r)
+    {
+        Componente& C = componentes[componente[extremidade[0][r]]];
+        ++C.num_rotas;
+        C.comprimento += comprimento[r];
+    }
+}
+
+/// Retorna um Ponto do mapa, passando a id como parametro.
+/// Se a id for inexistente, retorna um Ponto vazio.
+Ponto Planejador::getPonto(const IDPonto& Id) const
+{
+    Ponto P;
+    // Procura o handle do ponto no indice
+    HandlePonto h = getHandle(Id);
+    // Em caso de sucesso, monta o ponto a partir das colunas do mapa
+    if (h != HANDLE_NULO)
+    {
+        P.id = Id;
+        P.nome = nomePonto(h);
+        P.latitude = latitude[h];
+        P.longitude = longitude[h];
     }
     // Se nao encontrou, retorna um ponto vazio
-    return Ponto();
+    return P;
 }
 
 /// Retorna um Rota do mapa, passando a id como parametro.
 /// Se a id for inexistente, retorna um Rota vazio.
 Rota Planejador::getRota(const IDRota& Id) const
 {
-    // Procura uma rota que corresponde aa Id do parametro
-
-    // Testa se  uma ID vlida
-    if(Id.valid())
+    Rota R;
+    // Procura o handle da rota no indice
+    HandleRota h = getHandle(Id);
+    // Em caso de sucesso, monta a rota a partir das colunas do mapa
+    if (h != HANDLE_NULO)
     {
-        // Cria um interator para uma lista de rotas
-        list<Rota>::const_iterator itr;
-        // Procura o ID na lista de rotas
-        itr = find(rotas.begin(), rotas.end(), Id); // Em uma lista de rotas, procura uma ID (Rota == ID)
-
-        // Em caso de sucesso, retorna a rota encontrada
-        if(itr!=rotas.end())  // Se itr != rotas.end() significa que alguma rota correspondente foi encontrado
-        {
-            return *itr; // Retorna a desreferenciao do iterator
-        }
+        R.id = Id;
+        R.nome = nomeRota(h);
+        R.extremidade[0].set(string(idPonto(extremidade[0][h])));
+        R.extremidade[1].set(string(idPonto(extremidade[1][h])));
+        R.comprimento = comprimento[h];
+        R.tempo = tempoRota(h);
+        R.pedagio = pedagioRota(h);
+        R.classe = classeRota(h);
     }
-
     // Se nao encontrou, retorna uma rota vazia
-    return Rota();
+    return R;
+}
+
+/// Retorna o handle de um ponto, passando a id como parametro.
+/// Se a id for inexistente, retorna HANDLE_NULO.
+HandlePonto Planejador::getHandle(const IDPonto& Id) const
+{
+    return idsPontos.procurar(Id.str());
+}
+
+/// Retorna o handle de uma rota, passando a id como parametro.
+/// Se a id for inexistente, retorna HANDLE_NULO.
+HandleRota Planejador::getHandle(const IDRota& Id) const
+{
+    return idsRotas.procurar(Id.str());
+}
+
+/// Memoria ocupada por um vetor (em bytes)
+template<class T>
+static size_t memoria(const vector<T>& V)
+{
+    return V.capacity()*sizeof(T);
+}
+
+/// Memoria ocupada pelo mapa e pelo seu indice, sem os rotulos de hubs (em bytes)
+size_t Planejador::memoriaMapa() const
+{
+    return idsPontos.memoria() + idsRotas.memoria() + nomes.memoria() +
+           memoria(indNomePonto) + memoria(indNomeRota) +
+           memoria(latitude) + memoria(longitude) + memoria(comprimento) +
+           memoria(extremidade[0]) + memoria(extremidade[1]) +
+           memoria(tempo) + memoria(pedagio) + memoria(classe) +
+           memoria(inicioAdj) + memoria(rotaAdj) + memoria(vizinhoAdj) +
+           memoria(componente) + memoria(componentes);
 }
 
 /// Imprime os pontos do mapa no console
 void Planejador::imprimirPontos() const
 {
-    for (const auto& P : pontos)
+    for (HandlePonto h=0; h<numPontos(); ++h)
     {
-        cout << P.id << '\t' << P.nome
-             << " (" <<P.latitude << ',' << P.longitude << ")\n";
+        cout << idPonto(h) << '\t' << nomePonto(h)
+             << " (" << latitude[h] << ',' << longitude[h] << ")\n";
     }
 }
 
 /// Imprime as rotas do mapa no console
 void Planejador::imprimirRotas() const
 {
-    for (const auto& R : rotas)
+    for (HandleRota h=0; h<numRotas(); ++h)
+    {
+        cout << idRota(h) << '\t' << nomeRota(h) << '\t' << comprimento[h] << "km"
+             << " [" << idPonto(extremidade[0][h]) << ',' << idPonto(extremidade[1][h]) << "]\n";
+    }
+}
+
+/// Imprime os componentes conexos do mapa no console, do maior para o menor
+void Planejador::imprimirComponentes() const
+{
+    vector<const Componente*> ordem;
+    for (const auto& C : componentes) ordem.push_back(&C);
+    stable_sort(ordem.begin(), ordem.end(), [](const Componente* A, const Componente* B)
+    {
+        return A->num_pontos > B->num_pontos;
+    });
+    for (const Componente* C : ordem)
+    {
+        cout << idPonto(C->representante) << '\t' << C->num_pontos << " pontos\t"
+             << C->num_rotas << " rotas\t" << C->comprimento << "km\n";
+    }
+}
+
+/// Leh um ponto de um arquivo de pontos, a partir da posicao atual do stream.
+/// Retorna 0 em caso de sucesso ou o codigo do erro de leitura.
+static int lerPonto(istream& arq, Ponto& P, string& prov)
+{
+    // Leh a ID
+    getline(arq,prov,';');
+    if (arq.fail()) return 3;
+    P.id.set(move(prov));
+    if (!P.valid()) return 4;
+
+    // Leh o nome
+    getline(arq,prov,';');
+    if (arq.fail() || prov.size()<2) return 5;
+    P.nome = move(prov);
+
+    // Leh a latitude
+    arq >> P.latitude;
+    if (arq.fail()) return 6;
+    arq.ignore(1,';');
+
+    // Leh a longitude
+    arq >> P.longitude;
+    if (arq.fail()) return 7;
+    arq >> ws;
+
+    return 0;
+}
+
+/// Colunas obrigatorias do arquivo de rotas
+static const string CABECALHO_ROTAS = "ID;Nome;Extremidade 1;Extremidade 2;Comprimento";
+/// Colunas opcionais do arquivo de rotas, na ordem em que devem aparecer
+static const char* const COLUNAS_EXTRAS[] = {"Tempo", "Pedagio", "Classe"};
+static const int MAX_COLUNAS_EXTRAS = 3;
+
+/// Retorna o numero de colunas opcionais indicadas no cabecalho do arquivo de rotas,
+/// ou -1 se o cabecalho estiver errado
+static int colunasExtras(const string& cabecalho)
+{
+    if (cabecalho.compare(0, CABECALHO_ROTAS.size(), CABECALHO_ROTAS) != 0) return -1;
+    string esperado = CABECALHO_ROTAS;
+    for (int n=0; n<=MAX_COLUNAS_EXTRAS; ++n)
+    {
+        if (cabecalho == esperado) return n;
+        if (n < MAX_COLUNAS_EXTRAS) esperado = esperado + ';' + COLUNAS_EXTRAS[n];
+    }
+    return -1;
+}
+
+/// Leh uma rota de um arquivo de rotas, a partir da posicao atual do stream.
+/// O parametro extras eh o numero de colunas opcionais do arquivo.
+/// O parametro procurar(id) retorna o handle do ponto do mapa com a id fornecida
+/// (HANDLE_NULO se nao existir), que eh colocado em extremidade.
+/// Retorna 0 em caso de sucesso ou o codigo do erro de leitura.
+template<class ProcuraPonto>
+static int lerRota(istream& arq, Rota& R, HandlePonto extremidade[2], string& prov,
+                   int extras, const ProcuraPonto& procurar)
+{
+    // Leh a ID
+    getline(arq,prov,';');
+    if (arq.fail()) return 3;
+    R.id.set(move(prov));
+    if (!R.valid()) return 4;
+
+    // Leh o nome
+    getline(arq,prov,';');
+    if (arq.fail() || prov.size()<2) return 4;
+    R.nome = move(prov);
+
+    // Leh a id da extremidade[0]
+    getline(arq,prov,';');
+    if (arq.fail()) return 6;
+    R.extremidade[0].set(move(prov));
+    if (!R.extremidade[0].valid()) return 7;
+    // Caso ponto nao exista, erro 8
+    extremidade[0] = procurar(R.extremidade[0]);
+    if (extremidade[0] == HANDLE_NULO) return 8;
+
+    // Leh a id da extremidade[1]
+    getline(arq,prov,';');
+    if (arq.fail()) return 9;
+    R.extremidade[1].set(move(prov));
+    if (!R.extremidade[1].valid()) return 10;
+    // Caso ponto nao exista, erro 11
+    extremidade[1] = procurar(R.extremidade[1]);
+    if (extremidade[1] == HANDLE_NULO) return 11;
+
+    // Leh o comprimento
+    arq >> R.comprimento;
+    if (arq.fail()) return 12;
+
+    // Leh as colunas opcionais
+    R.tempo = R.pedagio = 0.0;
+    R.classe = 0;
+    if (extras >= 1)
+    {
+        arq.ignore(1,';');
+        arq >> R.tempo;
+        if (arq.fail() || R.tempo < 0.0) return 14;
+    }
+    if (extras >= 2)
     {
-        cout << R.id << '\t' << R.nome << '\t' << R.comprimento << "km"
-             << " [" << R.extremidade[0] << ',' << R.extremidade[1] << "]\n";
+        arq.ignore(1,';');
+        arq >> R.pedagio;
+        if (arq.fail() || R.pedagio < 0.0) return 15;
     }
+    if (extras >= 3)
+    {
+        arq.ignore(1,';');
+        arq >> R.classe;
+        if (arq.fail() || R.classe < 0 || R.classe > 255) return 16;
+    }
+    arq >> ws;
+
+    return 0;
 }
 
 /// Leh um mapa dos arquivos arq_pontos e arq_rotas.
@@ -145,15 +790,11 @@ void Planejador::imprimirRotas() const
 bool Planejador::ler(const std::string& arq_pontos,
                      const std::string& arq_rotas)
 {
-    // Listas temporarias para armazenamento dos dados lidos
-    list<Ponto> listP;
-    list<Rota> listR;
-    // Variaveis auxiliares para buscas nas listas
-    list<Ponto>::iterator itr_ponto;
-    list<Rota>::iterator itr_rota;
+    // Mapa temporario para armazenamento dos dados lidos
+    Planejador novo;
     // Variaveis auxiliares para leitura de dados
     Ponto P;
-    Rota R;
+    RotaLida R;
     string prov;
 
     // Leh os pontos do arquivo
@@ -171,35 +812,14 @@ bool Planejador::ler(const std::string& arq_pontos,
         // Leh os pontos
         do
         {
-            // Leh a ID
-            getline(arq,prov,';');
-            if (arq.fail()) throw 3;
-            P.id.set(move(prov));
-            if (!P.valid()) throw 4;
-
-            // Leh o nome
-            getline(arq,prov,';');
-            if (arq.fail() || prov.size()<2) throw 5;
-            P.nome = move(prov);
-
-            // Leh a latitude
-            arq >> P.latitude;
-            if (arq.fail()) throw 6;
-            arq.ignore(1,';');
-
-            // Leh a longitude
-            arq >> P.longitude;
-            if (arq.fail()) throw 7;
-            arq >> ws;
-
-            // Verifica se jah existe ponto com a mesma ID no conteiner de pontos lidos (listP) - FIND
-            // Caso exista, throw 8
-
-            // Se o find no retornar um iterador para listP.end() significa que a ID j existe (ERRO)
-            if(find(listP.begin(), listP.end(), P)!=listP.end()) throw 8; // Ponto sobrecarregado == com outro ponto
-
-            // Inclui o ponto na lista de pontos
-            listP.push_back(move(P));
+            // Leh o ponto
+            int erro = lerPonto(arq,P,prov);
+            if (erro != 0) throw erro;
+
+            // Inclui o ponto no mapa lido, verificando se jah existe ponto com a mesma ID
+            // Caso exista, throw 8; se a ID ou o nome nao couberem, throw ERRO_TEXTOS
+            erro = novo.incluir(P);
+            if (erro != 0) throw erro;
         }
         while (!arq.eof());
 
@@ -220,63 +840,25 @@ bool Planejador::ler(const std::string& arq_pontos,
         ifstream arq(arq_rotas);
         if (!arq.is_open()) throw 1;
 
-        // Leh o cabecalho
+        // Leh o cabecalho, que indica as colunas opcionais
         getline(arq,prov);
-        if (arq.fail() ||
-                prov != "ID;Nome;Extremidade 1;Extremidade 2;Comprimento") throw 2;
+        int extras = colunasExtras(prov);
+        if (arq.fail() || extras < 0) throw 2;
 
         // Leh as rotas
         do
         {
-            // Leh a ID
-            getline(arq,prov,';');
-            if (arq.fail()) throw 3;
-            R.id.set(move(prov));
-            if (!R.valid()) throw 4;
-
-            // Leh o nome
-            getline(arq,prov,';');
-            if (arq.fail() || prov.size()<2) throw 4;
-            R.nome = move(prov);
-
-            // Leh a id da extremidade[0]
-            getline(arq,prov,';');
-            if (arq.fail()) throw 6;
-            R.extremidade[0].set(move(prov));
-            if (!R.extremidade[0].valid()) throw 7;
-
-            // Verifica se a Id corresponde a um ponto no conteiner de pontos lidos (listP)
-            // Caso ponto nao exista, throw 8
-
-            // Se o find retorna um iterador para listP.end() significa que a ID no foi achada (ERRO)
-            if(find(listP.begin(), listP.end(), R.extremidade[0])==listP.end()) throw 8; //sobrecarga == no ponto em relao a uma id
-
-            // Leh a id da extremidade[1]
-            getline(arq,prov,';');
-            if (arq.fail()) throw 9;
-            R.extremidade[1].set(move(prov));
-            if (!R.extremidade[1].valid()) throw 10;
-
-            // Verifica se a Id corresponde a um ponto no conteiner de pontos lidos (listP)
-            // Caso ponto nao exista, throw 11
-
-            // Se o find retorna um iterador para listP.end() significa que a ID no foi achada (ERRO)
-            if(find(listP.begin(), listP.end(), R.extremidade[1])==listP.end()) throw 11; //sobrecarga == no ponto em relao a uma id
-
-
-            // Leh o comprimento
-            arq >> R.comprimento;
-            if (arq.fail()) throw 12;
-            arq >> ws;
-
-            // Verifica se jah existe rota com a mesma ID no conteiner de rotas lidas (listR)
-            // Caso exista, throw 13
-
-            // Se o find no retornar um iterador para listP.end() significa que a ID j existe (ERRO)
-            if(find(listR.begin(), listR.end(), R)!=listR.end()) throw 13; // Rota sobrecarregado == com outra rota
-
-            // Inclui a rota na lista de rotas
-            listR.push_back(move(R));
+            // Leh a rota, procurando as extremidades nos pontos do mapa lido
+            int erro = lerRota(arq,R.rota,R.extremidade,prov,extras,[&novo](const IDPonto& id)
+            {
+                return novo.getHandle(id);
+            });
+            if (erro != 0) throw erro;
+
+            // Inclui a rota no mapa lido, verificando se jah existe rota com a mesma ID
+            // Caso exista, throw 13; se a ID ou o nome nao couberem, throw ERRO_TEXTOS
+            erro = novo.incluir(R);
+            if (erro != 0) throw erro;
         }
         while (!arq.eof());
 
@@ -291,225 +873,1424 @@ bool Planejador::ler(const std::string& arq_pontos,
     }
 
     // Soh chega aqui se nao entrou no catch, jah que ele termina com return.
-    // Move as listas de pontos e rotas para o planejador.
-    pontos = move(listP);
-    rotas = move(listR);
+    // Move o mapa lido para o planejador.
+    novo.indexar();
+    *this = move(novo);
 
     return true;
 }
 
 /// *******************************************************************************
-/// Calcula o caminho entre a origem e o destino do planejador usando o algoritmo A*
+/// Leitura do mapa em paralelo
 /// *******************************************************************************
 
-/// Noh: os elementos dos conjuntos de busca do algoritmo A*
-
-struct Noh // Elementos dos contineres Aberto e Fechado
+/// Buffer de entrada sobre um trecho de memoria: permite ler um trecho
+/// do arquivo com as mesmas funcoes de istream, sem copiar os dados
+class BufferMemoria: public streambuf
 {
-    IDPonto id_pt; // Id do ponto
-    IDRota id_rt; // Id da rota do antecessor at o ponto
-    double g; // Custo passado
-    double h; // Custo futuro
-    double f() const // Custo total
+public:
+    BufferMemoria(char* ini, char* fim)
+    {
+        setg(ini,ini,fim);
+    }
+    // Numero de caracteres jah lidos
+    size_t posicao() const
     {
-        return g+h; // Retorna soma do custo passado com o custo futuro
+        return gptr()-eback();
     }
+};
 
-    // Construtor default
-    Noh(): id_pt(), id_rt(), g(0.0), h(0.0) {}
+/// Itens lidos de um trecho do arquivo por uma thread. Os ponteiros para os itens
+/// soh sao tomados depois da leitura do trecho inteiro, quando o vetor nao muda mais.
+template<class T>
+struct TrechoLido
+{
+    std::vector<T> itens; // Itens lidos com sucesso, na ordem do arquivo
+    int erro;             // Codigo do erro que interrompeu a leitura do trecho (0 se nenhum)
 
-    // Sobrecarga de operadores
-    bool operator==(const IDPonto& idponto) const   // Sobrecarga do operador == (Noh == ID)
+    TrechoLido(): itens(), erro(0) {}
+};
+
+/// Leh todo o conteudo de um arquivo para a memoria.
+/// Retorna false se nao conseguir abrir o arquivo. Um arquivo que abre mas nao pode
+/// ser lido (um diretorio, por exemplo) fica com o conteudo vazio: a leitura do
+/// cabecalho falha, com o mesmo erro de ler().
+static bool lerArquivo(const string& nome, string& conteudo)
+{
+    ifstream arq(nome, ios::binary);
+    if (!arq.is_open()) return false;
+    conteudo.clear();
+    if (arq.peek() == char_traits<char>::eof()) return true;
+
+    // Tamanho conhecido: uma unica leitura
+    arq.seekg(0, ios::end);
+    streamoff tamanho = arq.tellg();
+    arq.seekg(0, ios::beg);
+    if (arq && tamanho >= 0)
     {
-        return (id_pt == idponto); // Um noh  igual a uma ID, se a IDPonto for igual a ID fornecida
+        conteudo.resize(static_cast<size_t>(tamanho));
+        arq.read(&conteudo[0], conteudo.size());
+        conteudo.resize(static_cast<size_t>(arq.gcount()));
+        return true;
     }
-    bool operator<(const Noh& n) const
+
+    // Sem tamanho conhecido (um pipe, por exemplo): leh em blocos ateh o fim
+    arq.clear();
+    const size_t BLOCO = 1<<20;
+    size_t lido = 0;
+    while (arq)
     {
-        return (f() < n.f());
+        conteudo.resize(lido + BLOCO);
+        arq.read(&conteudo[lido], BLOCO);
+        lido += static_cast<size_t>(arq.gcount());
     }
-};
+    conteudo.resize(lido);
+    return true;
+}
 
-/// Calcula o caminho entre a origem e o destino do planejador usando o algoritmo A*
-/// Retorna o comprimento do caminho encontrado.
-/// (<0 se  parametros invalidos ou nao existe caminho).
-/// O parametro C retorna o caminho encontrado
-/// (vazio se  parametros invalidos ou nao existe caminho).
-/// O parametro NA retorna o numero de nos em aberto ao termino do algoritmo A*
-/// (<0 se parametros invalidos, retorna >0 mesmo quando nao existe caminho).
-/// O parametro NF retorna o numero de nos em fechado ao termino do algoritmo A*
-/// (<0 se parametros invalidos, retorna >0 mesmo quando nao existe caminho).
-double Planejador::calculaCaminho(const IDPonto& id_origem,
-                                  const IDPonto& id_destino,
-                                  Caminho& C, int& NA, int& NF)
+/// Leh o cabecalho de um arquivo do mapa.
+/// Retorna a posicao em que comecam os dados ou string::npos se nao conseguir ler.
+static size_t lerCabecalho(string& conteudo, string& cabecalho)
 {
-    // Zera o caminho resultado
-    C.clear();
+    BufferMemoria buf(&conteudo[0], &conteudo[0]+conteudo.size());
+    istream arq(&buf);
+    getline(arq,cabecalho);
+    if (arq.fail()) return string::npos;
+    return buf.posicao();
+}
 
-    try
+/// Divide o intervalo [ini,fim) em N trechos que terminam no fim de uma linha.
+/// Retorna os N+1 limites dos trechos. O 1o trecho sempre contem a 1a linha.
+static vector<char*> dividirEmTrechos(char* ini, char* fim, unsigned N)
+{
+    vector<char*> limites(N+1);
+    limites[0] = ini;
+    for (unsigned i=1; i<N; ++i)
     {
-        // Mapa vazio
-        if (empty()) throw 1;
+        char* p = max(ini + (fim-ini)*i/N, limites[i-1]);
+        char* q = static_cast<char*>(memchr(p, '\n', fim-p));
+        limites[i] = (q==nullptr ? fim : q+1);
+    }
+    limites[N] = fim;
+    return limites;
+}
 
-        // Calcula o ponto que corresponde a id_origem.
-        // Se nao existir, throw 4
-        Ponto pt_orig = getPonto(id_origem);
-        if (!pt_orig.valid()) throw 4;
+/// Leh os itens de um trecho do arquivo com a funcao lerItem(istream&,T&),
+/// a mesma usada na leitura sequencial.
+template<class T, class LeitorItem>
+static void lerTrecho(char* ini, char* fim, bool primeiro,
+                      TrechoLido<T>& trecho, const LeitorItem& lerItem)
+{
+    BufferMemoria buf(ini,fim);
+    istream arq(&buf);
+    // Na leitura sequencial, os espacos entre dois itens sao consumidos ao fim do
+    // item anterior. Um trecho que contem apenas espacos nao tem itens.
+    if (!primeiro)
+    {
+        arq >> ws;
+        if (arq.eof()) return;
+    }
+    T item;
+    do
+    {
+        int erro = lerItem(arq,item);
+        if (erro != 0)
+        {
+            trecho.erro = erro;
+            return;
+        }
+        trecho.itens.push_back(move(item));
+    }
+    while (!arq.eof());
+}
 
-        // Calcula o ponto que corresponde a id_destino.
-        // Se nao existir, throw 5
-        Ponto pt_dest = getPonto(id_destino);
-        if (!pt_dest.valid()) throw 5;
+/// Tamanho maximo de um trecho de arquivo lido por uma thread
+static const size_t TAMANHO_TRECHO = 16 << 20;
+
+/// Leh os itens de um arquivo carregado em conteudo, a partir da posicao pos, com a
+/// funcao lerItem(istream&,T&,string&), e os passa para incluir(itens), um vetor de
+/// ponteiros para os itens na ordem do arquivo. Os trechos do arquivo sao lidos em
+/// paralelo, em grupos de num_threads trechos de ateh TAMANHO_TRECHO bytes: cada grupo
+/// eh incluido de uma vez antes da leitura do proximo, o que limita a memoria ocupada
+/// pelos itens lidos e ainda nao incluidos.
+/// Retorna 0 em caso de sucesso ou o codigo do primeiro erro na ordem do arquivo:
+/// erro de leitura ou o codigo retornado por incluir(itens), se diferente de 0.
+template<class T, class LeitorItem, class Inclusao>
+static int lerEmParalelo(string& conteudo, size_t pos, unsigned num_threads,
+                         const LeitorItem& lerItem, const Inclusao& incluir)
+{
+    char* ini = &conteudo[0]+pos;
+    char* fim = &conteudo[0]+conteudo.size();
+    const unsigned num_trechos = max<size_t>(num_threads, (fim-ini)/TAMANHO_TRECHO + 1);
+    vector<char*> limites = dividirEmTrechos(ini, fim, num_trechos);
+    vector<TrechoLido<T>> trechos(num_threads);
+    for (unsigned k0=0; k0<num_trechos; k0+=num_threads)
+    {
+        const unsigned N = min(num_threads, num_trechos-k0);
+        executarEmParalelo(N, [&](unsigned k)
+        {
+            string prov;
+            lerTrecho(limites[k0+k], limites[k0+k+1], k0+k==0, trechos[k],
+                      [&prov,&lerItem](istream& arq, T& item)
+            {
+                return lerItem(arq,item,prov);
+            });
+        });
+        // Itens do grupo ateh o fim do primeiro trecho com erro de leitura. Os itens
+        // desse trecho vem antes do erro: uma repeticao entre eles eh o primeiro erro.
+        vector<const T*> itens;
+        int erro = 0;
+        for (unsigned k=0; k<N && erro==0; ++k)
+        {
+            for (const auto& item : trechos[k].itens) itens.push_back(&item);
+            erro = trechos[k].erro;
+        }
+        const int erro_inclusao = incluir(itens);
+        if (erro_inclusao != 0) return erro_inclusao;
+        if (erro != 0) return erro;
+        executarEmParalelo(N, [&trechos](unsigned k)
+        {
+            trechos[k].itens.clear();
+        });
+    }
+    return 0;
+}
 
-        /* *****************************  /
-        /  IMPLEMENTACAO DO ALGORITMO A*  /
-        /  ***************************** */
+/// Leh um mapa dos arquivos arq_pontos e arq_rotas usando varias threads.
+/// Produz o mesmo mapa e os mesmos codigos de erro que ler(), desde que cada
+/// ponto ou rota ocupe uma linha do arquivo.
+bool Planejador::lerParalelo(const std::string& arq_pontos,
+                             const std::string& arq_rotas,
+                             unsigned num_threads)
+{
+    if (num_threads == 0) num_threads = max(thread::hardware_concurrency(), 1u);
 
-        Noh atual; // Noh inicial
-        atual.id_pt = id_origem; // Id do n ser a Id do ponto de origem
-        // atual.id_rt = vazio - j definido no construtor default
-        // atual.g = 0.0 - j definido no construtor default
-        atual.h = haversine(pt_orig, pt_dest);
+    // Conteudo dos arquivos
+    string conteudo;
+    // Mapa temporario para armazenamento dos dados lidos
+    Planejador novo;
 
-        // Inicializa os conjuntos de Noh's
-        list<Noh> Aberto;
-        vector<Noh> Fechado; // Lista, deque ou vetor?
-        Aberto.push_front(atual); // Incluir atual no Aberto
+    // Leh os pontos do arquivo
+    try
+    {
+        // Leh o arquivo de pontos
+        if (!lerArquivo(arq_pontos, conteudo)) throw 1;
 
-        // Lao principal do algoritmo
-        while( (!Aberto.empty())&&(atual.id_pt != id_destino))
+        // Leh o cabecalho
+        string cabecalho;
+        size_t pos = lerCabecalho(conteudo, cabecalho);
+        if (pos == string::npos || cabecalho != "ID;Nome;Latitude;Longitude") throw 2;
+
+        // Leh os pontos em paralelo e os inclui no mapa, na ordem do arquivo, com as
+        // ids repetidas procuradas em paralelo. O erro reportado eh o do primeiro ponto
+        // com problema: erro de leitura, id repetida (erro 8) ou ids e nomes que nao
+        // cabem (ERRO_TEXTOS).
+        int erro = lerEmParalelo<Ponto>(conteudo, pos, num_threads, lerPonto,
+                                        [&novo,num_threads](const vector<const Ponto*>& P)
         {
+            return novo.incluir(P, num_threads);
+        });
+        if (erro != 0) throw erro;
+    }
+    catch (int i)
+    {
+        cerr << "Erro " << i << " na leitura do arquivo de pontos "
+             << arq_pontos << endl;
+        return false;
+    }
+
+    // Leh as rotas do arquivo
+    try
+    {
+        // Leh o arquivo de rotas
+        if (!lerArquivo(arq_rotas, conteudo)) throw 1;
+
+        // Leh o cabecalho, que indica as colunas opcionais
+        string cabecalho;
+        size_t pos = lerCabecalho(conteudo, cabecalho);
+        int extras = colunasExtras(cabecalho);
+        if (pos == string::npos || extras < 0) throw 2;
+
+        // Leh as rotas em paralelo e as inclui no mapa, na ordem do arquivo.
+        // As extremidades sao procuradas durante a leitura, nos pontos do mapa lido
+        // (somente leitura). O erro reportado eh o da primeira rota com problema:
+        // erro de leitura, id repetida (erro 13) ou ids e nomes que nao cabem (ERRO_TEXTOS).
+        auto procurar = [&novo](const IDPonto& id)
+        {
+            return novo.getHandle(id);
+        };
+        int erro = lerEmParalelo<RotaLida>(conteudo, pos, num_threads,
+                                           [extras,&procurar](istream& arq, RotaLida& R,
+                                                              string& prov)
+        {
+            return lerRota(arq,R.rota,R.extremidade,prov,extras,procurar);
+        }, [&novo,num_threads](const vector<const RotaLida*>& R)
+        {
+            return novo.incluir(R, num_threads);
+        });
+        if (erro != 0) throw erro;
+    }
+    catch (int i)
+    {
+        cerr << "Erro " << i << " na leitura do arquivo de rotas "
+             << arq_rotas << endl;
+        return false;
+    }
+
+    // Soh chega aqui se nao entrou no catch, jah que ele termina com return.
+    // Move o mapa lido para o planejador.
+    novo.indexar();
+    *this = move(novo);
+
+    return true;
+}
+
+/// *******************************************************************************
+/// Calcula o caminho entre a origem e o destino do planejador usando o algoritmo A*
+/// *******************************************************************************
+
+/// Noh: os elementos do conjunto Aberto do algoritmo A*
+/// Aberto eh um heap ordenado pelo custo total f. Entre nohs de mesmo custo, sai
+/// primeiro o que entrou primeiro (seq), como em uma lista ordenada em que cada
+/// novo noh eh inserido depois dos nohs de mesmo custo.
+struct Noh
+{
+    HandlePonto pt; // Handle do ponto
+    double f;       // Custo total
+    unsigned seq;   // Ordem de insercao em Aberto
+
+    // Sobrecarga de operadores
+    bool operator>(const Noh& n) const
+    {
+        return (f > n.f || (f == n.f && seq > n.seq));
+    }
+};
+
+/// Os dados de uma busca A*: os conjuntos Aberto e Fechado e os dados de cada ponto.
+/// Os vetores sao reaproveitados de uma busca para outra: os dados de um ponto
+/// soh valem para a busca atual se marca[v] == geracao.
+class BuscaAEstrela
+{
+public:
+    std::vector<unsigned> marca;         // Geracao em que o ponto foi visitado
+    std::vector<double> g;               // Custo passado
+    std::vector<double> h;               // Custo futuro
+    std::vector<HandleRota> rota;        // Rota do antecessor ateh o ponto
+    std::vector<HandlePonto> antecessor; // Ponto antecessor
+    std::vector<unsigned> seq;           // seq do noh do ponto em Aberto
+    std::vector<char> fechado;           // O ponto estah em Fechado?
+    std::vector<Noh> aberto;             // Heap de nohs em aberto (inclui nohs substituidos)
+    unsigned geracao;                    // Identificador da busca atual
+    unsigned contador;                   // Proximo seq
+    int NA;                              // Numero de nohs em aberto (sem os substituidos)
+    int NF;                              // Numero de nohs em fechado
+    HandlePonto origem;                  // Origem da busca
+    HandlePonto destino;                 // Destino para o qual os custos futuros foram calculados
+    HandlePonto pendente;                // Destino incluido em Fechado mas ainda nao expandido
+
+    BuscaAEstrela(): geracao(0), contador(0), NA(0), NF(0),
+        origem(HANDLE_NULO), destino(HANDLE_NULO), pendente(HANDLE_NULO) {}
+
+    /// Prepara uma nova busca a partir da origem orig, em um mapa com N pontos.
+    /// A origem eh incluida em Aberto; o seu custo futuro eh calculado
+    /// quando for fornecido o destino.
+    void iniciar(size_t N, HandlePonto orig)
+    {
+        if (marca.size() < N)
+        {
+            marca.resize(N, 0);
+            g.resize(N);
+            h.resize(N);
+            rota.resize(N);
+            antecessor.resize(N);
+            seq.resize(N);
+            fechado.resize(N);
+        }
+        if (++geracao == 0)
+        {
+            fill(marca.begin(), marca.end(), 0);
+            geracao = 1;
+        }
+        aberto.clear();
+        contador = 0;
+        NA = NF = 0;
+        origem = orig;
+        destino = pendente = HANDLE_NULO;
+        incluir(orig, 0.0, 0.0, HANDLE_NULO, HANDLE_NULO);
+    }
+
+    /// Testa se o ponto jah estah em Aberto ou Fechado
+    bool visitado(HandlePonto v) const
+    {
+        return marca[v] == geracao;
+    }
+
+    /// Inclui um ponto em Aberto, com os custos e o antecessor fornecidos.
+    /// Se o ponto jah estava em Aberto, o noh anterior passa a ser ignorado.
+    void incluir(HandlePonto v, double gv, double hv, HandleRota r, HandlePonto ant)
+    {
+        if (visitado(v)) --NA;
+        marca[v] = geracao;
+        fechado[v] = false;
+        g[v] = gv;
+        h[v] = hv;
+        rota[v] = r;
+        antecessor[v] = ant;
+        seq[v] = contador;
+        aberto.push_back(Noh{v, gv+hv, contador++});
+        push_heap(aberto.begin(), aberto.end(), greater<Noh>());
+        ++NA;
+    }
+
+    /// Retira o noh de menor custo de Aberto e o inclui em Fechado
+    HandlePonto fechar()
+    {
+        while (true)
+        {
+            pop_heap(aberto.begin(), aberto.end(), greater<Noh>());
+            Noh n = aberto.back();
+            aberto.pop_back();
+            // Ignora nohs substituidos por outro de menor custo
+            if (seq[n.pt] != n.seq || fechado[n.pt]) continue;
+            fechado[n.pt] = true;
+            --NA;
+            ++NF;
+            return n.pt;
+        }
+    }
+
+    /// Recalcula os custos futuros dos nohs em Aberto com a funcao custoFuturo(v)
+    /// e reorganiza o heap. Os nohs substituidos sao descartados.
+    template<class FuncaoCustoFuturo>
+    void reordenar(const FuncaoCustoFuturo& custoFuturo)
+    {
+        size_t n = 0;
+        for (const Noh& N : aberto)
+        {
+            if (seq[N.pt] != N.seq || fechado[N.pt]) continue;
+            h[N.pt] = custoFuturo(N.pt);
+            aberto[n++] = Noh{N.pt, g[N.pt]+h[N.pt], N.seq};
+        }
+        aberto.resize(n);
+        make_heap(aberto.begin(), aberto.end(), greater<Noh>());
+    }
+
+    /// Testa se o caminho ateh dest jah eh conhecido
+    bool resolvido(HandlePonto dest) const
+    {
+        return (dest == origem || (visitado(dest) && fechado[dest]));
+    }
+};
+
+/// Algoritmo A* sobre o indice do mapa, com o custo de cada rota dado por custo(r)
+/// e o custo futuro estimado por fator_h*(distancia em linha reta ateh o destino).
+/// Continua a busca ateh que dest seja incluido em Fechado ou Aberto fique vazio.
+/// Retorna false se a busca foi interrompida pelos limites.
+template<class FuncaoCusto>
+bool Planejador::buscaAEstrela(BuscaAEstrela& busca, HandlePonto dest,
+                               const FuncaoCusto& custo, double fator_h,
+                               const Limites* limites) const
+{
+    // Destino jah alcancado
+    if (busca.resolvido(dest)) return true;
+
+    // Custo futuro: proporcional aa distancia em linha reta ateh o destino
+    // (nulo se fator_h == 0: busca de Dijkstra)
+    auto custoFuturo = [this,dest,fator_h](HandlePonto v)
+    {
+        if (v == dest || fator_h == 0.0) return 0.0;
+        return fator_h*haversine(latitude[v], longitude[v], latitude[dest], longitude[dest]);
+    };
+
+    // Novo destino: os nohs em Aberto sao reordenados pelo novo custo futuro.
+    // Como a estimativa eh consistente para qualquer destino, os nohs em Fechado
+    // continuam com o custo passado minimo.
+    // Sem custo futuro, os custos dos nohs em Aberto nao mudam.
+    if (dest != busca.destino)
+    {
+        if (fator_h != 0.0) busca.reordenar(custoFuturo);
+        busca.destino = dest;
+    }
+
+    // Gera os sucessores de "atual"
+    auto expandir = [&](HandlePonto atual)
+    {
+        for (int k=inicioAdj[atual]; k<inicioAdj[atual+1]; ++k)
+        {
+            HandlePonto suc = vizinhoAdj[k];
+            // Noh jah existe em Fechado
+            if (busca.visitado(suc) && busca.fechado[suc]) continue;
+
+            double g_suc = busca.g[atual] + custo(rotaAdj[k]);
+            if (busca.visitado(suc))
+            {
+                // Noh jah existe em Aberto: soh substitui se tiver menor custo total
+                double h_suc = busca.h[suc];
+                if (!(g_suc + h_suc < busca.g[suc] + h_suc)) continue;
+                busca.incluir(suc, g_suc, h_suc, rotaAdj[k], atual);
+            }
+            else
+            {
+                busca.incluir(suc, g_suc, custoFuturo(suc), rotaAdj[k], atual);
+            }
+        }
+    };
+
+    // O destino da busca anterior foi incluido em Fechado sem ser expandido
+    if (busca.pendente != HANDLE_NULO)
+    {
+        expandir(busca.pendente);
+        busca.pendente = HANDLE_NULO;
+    }
+
+    // Laco principal do algoritmo
+    int expansoes = 0;
+    while (busca.NA > 0 && !busca.resolvido(dest))
+    {
+        // Verifica os limites da consulta a cada Limites::INTERVALO nohs.
+        // A interrupcao ocorre entre duas expansoes, deixando a busca consistente.
+        if (limites != nullptr && ++expansoes == Limites::INTERVALO)
+        {
+            expansoes = 0;
+            if (limites->verificar() != EstadoConsulta::OK) return false;
+        }
+
+        // Le e exclui o noh de menor custo de Aberto e o inclui em Fechado
+        HandlePonto atual = busca.fechar();
+
+        // Expande se nao eh a solucao
+        if (atual != dest) expandir(atual);
+        else busca.pendente = atual;
+    }
+    return true;
+}
+
+/// Refaz o caminho ateh dest encontrado pela busca.
+/// Retorna o custo do caminho, ou -1 se dest nao foi alcancado.
+double Planejador::montarCaminho(const BuscaAEstrela& busca, HandlePonto dest,
+                                 CaminhoCompacto& C, bool acumulado) const
+{
+    // Encontrou solucao ou nao?
+    if (!busca.resolvido(dest)) return -1.0; // Nao existe solucao
+
+    // Refaz o caminho, do destino ateh a origem, pelos antecessores
+    for (HandlePonto v=dest; v!=HANDLE_NULO; v=busca.antecessor[v])
+    {
+        C.etapas.push_back(Etapa(busca.rota[v], v));
+    }
+    reverse(C.etapas.begin(), C.etapas.end());
+
+    // Comprimento e distancias acumuladas, da origem ao destino
+    double compr = 0.0;
+    if (acumulado) C.acumulado.reserve(C.etapas.size());
+    for (const auto& E : C.etapas)
+    {
+        if (E.rota != HANDLE_NULO) compr += comprimento[E.rota];
+        if (acumulado) C.acumulado.push_back(compr);
+    }
+    C.compr = compr;
+    C.custo = busca.g[dest];
+    return C.custo;
+}
+
+/// Executa acao(custo, fator_h), sendo custo(r) o custo da rota r segundo os pesos
+/// e fator_h o fator da estimativa do custo futuro pela distancia em linha reta
+template<class Acao>
+double Planejador::comPesos(const Pesos& pesos, const Acao& acao) const
+{
+    // Soh o comprimento: o custo de cada rota eh lido diretamente do vetor de comprimentos.
+    // Mantem a estimativa do algoritmo original (fator 1), para resultados identicos
+    // aos de sempre; ela soh eh exata se nenhuma rota for mais curta que a linha reta.
+    if (pesos.soComprimento())
+    {
+        auto custo = [this](HandleRota r)
+        {
+            return comprimento[r];
+        };
+        return acao(custo, 1.0);
+    }
+
+    // Combinacao linear dos atributos. O custo por km em linha reta de qualquer rota
+    // eh pelo menos fator_h, entao a estimativa do custo futuro nunca excede o custo
+    // real (mesmo com rotas mais curtas que a distancia em linha reta)
+    double fator_h = pesos.comprimento*razaoMinima[0] + pesos.tempo*razaoMinima[1] +
+                     pesos.pedagio*razaoMinima[2] + pesos.classe*razaoMinima[3];
+    auto custo = [this,&pesos](HandleRota r)
+    {
+        return pesos.comprimento*comprimento[r] + pesos.tempo*tempoRota(r) +
+               pesos.pedagio*pedagioRota(r) + pesos.classe*classeRota(r)*comprimento[r];
+    };
+    return acao(custo, fator_h);
+}
+
+/// Calcula o caminho entre a origem e o destino do planejador usando o algoritmo A*
+/// Retorna o comprimento do caminho encontrado.
+/// (<0 se  parametros invalidos ou nao existe caminho).
+/// O parametro C retorna o caminho encontrado
+/// (vazio se  parametros invalidos ou nao existe caminho).
+/// O parametro NA retorna o numero de nos em aberto ao termino do algoritmo A*
+/// (<0 se parametros invalidos, retorna >0 mesmo quando nao existe caminho).
+/// O parametro NF retorna o numero de nos em fechado ao termino do algoritmo A*
+/// (<0 se parametros invalidos, retorna >0 mesmo quando nao existe caminho).
+double Planejador::calculaCaminho(const IDPonto& id_origem,
+                                  const IDPonto& id_destino,
+                                  CaminhoCompacto& C, int& NA, int& NF,
+                                  bool acumulado) const
+{
+    return calculaCaminho(id_origem, id_destino, C, NA, NF, Pesos(), acumulado);
+}
+
+/// Calcula o caminho de menor custo entre a origem e o destino, segundo os pesos
+/// fornecidos, usando o algoritmo A*. Retorna o custo do caminho encontrado.
+double Planejador::calculaCaminho(const IDPonto& id_origem,
+                                  const IDPonto& id_destino,
+                                  CaminhoCompacto& C, int& NA, int& NF,
+                                  const Pesos& pesos, bool acumulado) const
+{
+    calcularCaminho(id_origem, id_destino, C, NA, NF, pesos, nullptr, acumulado);
+    return C.custoTotal();
+}
+
+/// Calcula o caminho de menor custo, respeitando os limites da consulta.
+/// Retorna o estado do termino da consulta.
+EstadoConsulta Planejador::calculaCaminho(const IDPonto& id_origem,
+                                          const IDPonto& id_destino,
+                                          CaminhoCompacto& C, int& NA, int& NF,
+                                          const Pesos& pesos, const Limites& limites,
+                                          bool acumulado) const
+{
+    return calcularCaminho(id_origem, id_destino, C, NA, NF, pesos, &limites, acumulado);
+}
+
+/// Calcula o caminho de menor custo entre a origem e o destino, segundo os pesos,
+/// interrompendo a busca se os limites (opcionais) forem atingidos.
+/// Retorna o estado do termino; o custo eh C.custoTotal() (<0 se nao eh OK).
+EstadoConsulta Planejador::calcularCaminho(const IDPonto& id_origem,
+                                           const IDPonto& id_destino,
+                                           CaminhoCompacto& C, int& NA, int& NF,
+                                           const Pesos& pesos, const Limites* limites,
+                                           bool acumulado) const
+{
+    // Zera o caminho resultado
+    C.clear();
+    C.mapa = this;
+
+    try
+    {
+        // Mapa vazio
+        if (empty()) throw 1;
+
+        // Calcula o ponto que corresponde a id_origem.
+        // Se nao existir, throw 4
+        HandlePonto orig = getHandle(id_origem);
+        if (orig == HANDLE_NULO) throw 4;
+
+        // Calcula o ponto que corresponde a id_destino.
+        // Se nao existir, throw 5
+        HandlePonto dest = getHandle(id_destino);
+        if (dest == HANDLE_NULO) throw 5;
+
+        // Pesos negativos
+        if (!pesos.valid()) throw 6;
+
+        // Origem e destino em componentes conexos diferentes: nao existe caminho
+        if (componente[orig] != componente[dest])
+        {
+            NA = NF = 0;
+            return EstadoConsulta::SEM_CAMINHO;
+        }
+
+        // Consulta jah cancelada ou expirada: nem inicia a busca
+        if (limites != nullptr)
+        {
+            EstadoConsulta estado = limites->verificar();
+            if (estado != EstadoConsulta::OK)
+            {
+                NA = NF = 0;
+                return estado;
+            }
+        }
+
+        // Os dados da busca sao reaproveitados entre as chamadas de cada thread
+        thread_local BuscaAEstrela busca;
+        busca.iniciar(numPontos(), orig);
+        bool completa = true;
+        comPesos(pesos, [&](const auto& custo, double fator_h)
+        {
+            completa = buscaAEstrela(busca, dest, custo, fator_h, limites);
+            return 0.0;
+        });
+
+        // Calcula numeros de nos da busca
+        NA = busca.NA;
+        NF = busca.NF;
+
+        // Busca interrompida pelos limites
+        if (!completa) return limites->verificar();
+
+        if (montarCaminho(busca, dest, C, acumulado) < 0.0) return EstadoConsulta::SEM_CAMINHO;
+        return EstadoConsulta::OK;
+    }
+    catch(int i)
+    {
+        cerr << "Erro " << i << " no calculo do caminho\n";
+    }
+
+    // Soh chega aqui se executou o catch, jah que o try termina sempre com return.
+    // Caminho C permanece vazio.
+    NA = NF = -1;
+    return EstadoConsulta::INVALIDA;
+}
+
+/// Calcula o caminho entre a origem e o destino, retornando um Caminho
+double Planejador::calculaCaminho(const IDPonto& id_origem,
+                                  const IDPonto& id_destino,
+                                  Caminho& C, int& NA, int& NF)
+{
+    CaminhoCompacto CC;
+    double compr = calculaCaminho(id_origem, id_destino, CC, NA, NF);
+    C = CC.paraCaminho();
+    return compr;
+}
+
+/* **************************
+   * CLASSE CAMINHOCOMPACTO *
+   ************************** */
+
+/// Converte para a representacao com ids (Caminho)
+Caminho CaminhoCompacto::paraCaminho() const
+{
+    Caminho C;
+    for (const auto& E : *this)
+    {
+        IDRota rota;
+        IDPonto ponto;
+        if (!E.origem()) rota.set(string(E.idRota()));
+        ponto.set(string(E.idPonto()));
+        C.push_back(pair(rota, ponto));
+    }
+    return C;
+}
+
+/// Escreve as etapas do caminho, uma por linha, diretamente no buffer do stream X
+void CaminhoCompacto::escrever(std::ostream& X) const
+{
+    // As linhas sao montadas em um buffer local e enviadas em blocos ao stream
+    char buffer[4096];
+    size_t n = 0;
+    auto descarregar = [&]()
+    {
+        if (X.rdbuf()->sputn(buffer, n) != streamsize(n)) X.setstate(ios::badbit);
+        n = 0;
+    };
+    auto copiar = [&](const char* S, size_t tam)
+    {
+        while (tam > 0)
+        {
+            if (n == sizeof(buffer)) descarregar();
+            size_t k = min(tam, sizeof(buffer)-n);
+            memcpy(buffer+n, S, k);
+            n += k;
+            S += k;
+            tam -= k;
+        }
+    };
+
+    for (const auto& E : *this)
+    {
+        if (E.origem())
+        {
+            copiar("De ", 3);
+        }
+        else
+        {
+            copiar("Por ", 4);
+            copiar(E.nomeRota().data(), E.nomeRota().size());
+            copiar(" ateh ", 6);
+        }
+        copiar(E.nomePonto().data(), E.nomePonto().size());
+        if (!E.origem())
+        {
+            // Mesmo formato de "X << double" com a precisao padrao
+            char num[32];
+            auto res = to_chars(num, num+sizeof(num), E.comprimento(), chars_format::general, 6);
+            copiar(" (", 2);
+            copiar(num, res.ptr-num);
+            copiar("km)", 3);
+        }
+        copiar("\n", 1);
+    }
+    descarregar();
+}
+
+/* *************************
+   * CLASSE SESSAOORIGEM   *
+   ************************* */
+
+/// Cria uma sessao de consultas a partir de id_origem no mapa G, com os pesos P
+SessaoOrigem::SessaoOrigem(const Planejador& G, const IDPonto& id_origem, const Pesos& P):
+    mapa(&G), orig(G.getHandle(id_origem)), pesos(P), busca(new BuscaAEstrela)
+{
+    if (orig != HANDLE_NULO) busca->iniciar(G.numPontos(), orig);
+}
+
+SessaoOrigem::SessaoOrigem(SessaoOrigem&&) noexcept = default;
+SessaoOrigem& SessaoOrigem::operator=(SessaoOrigem&&) noexcept = default;
+SessaoOrigem::~SessaoOrigem() = default;
+
+/// Calcula o caminho da origem da sessao ateh id_destino, continuando a busca anterior
+double SessaoOrigem::calculaCaminho(const IDPonto& id_destino,
+                                    CaminhoCompacto& C, int& NA, int& NF,
+                                    bool acumulado)
+{
+    // Zera o caminho resultado
+    C.clear();
+    C.mapa = mapa;
+
+    try
+    {
+        // Mapa vazio
+        if (mapa->empty()) throw 1;
 
-            // L e exclui o primeiro Noh de Aberto (o de menor custo)
-            atual = Aberto.front();
-            Aberto.pop_front();
-
-            // Inclui "atual" em Fechado
-            Fechado.push_back(atual);
-
-            // Expande se no  a soluo
-            if(atual.id_pt != id_destino)
+        // Origem inexistente
+        if (orig == HANDLE_NULO) throw 4;
+
+        // Calcula o ponto que corresponde a id_destino.
+        // Se nao existir, throw 5
+        HandlePonto dest = mapa->getHandle(id_destino);
+        if (dest == HANDLE_NULO) throw 5;
+
+        // Pesos negativos
+        if (!pesos.valid()) throw 6;
+
+        // Destino em outro componente conexo: nao existe caminho, e a busca nao eh alterada
+        if (mapa->getComponente(orig) != mapa->getComponente(dest))
+        {
+            NA = busca->NA;
+            NF = busca->NF;
+            return -1.0;
+        }
+
+        // Continua a busca, se o destino ainda nao foi alcancado
+        mapa->comPesos(pesos, [&](const auto& custo, double fator_h)
+        {
+            mapa->buscaAEstrela(*busca, dest, custo, fator_h);
+            return 0.0;
+        });
+
+        // Calcula numeros de nos da busca
+        NA = busca->NA;
+        NF = busca->NF;
+
+        return mapa->montarCaminho(*busca, dest, C, acumulado);
+    }
+    catch(int i)
+    {
+        cerr << "Erro " << i << " no calculo do caminho\n";
+    }
+
+    // Soh chega aqui se executou o catch, jah que o try termina sempre com return.
+    // Caminho C permanece vazio.
+    NA = NF = -1;
+    return -1.0;
+}
+
+/* *************************
+   * ROTULOS DE HUBS       *
+   ************************* */
+
+/// Ordem de importancia dos pontos para os rotulos de hubs, por dissecao aninhada
+/// geografica: o conjunto de pontos eh dividido ao meio pela mediana da coordenada de
+/// maior extensao, e os pontos de uma metade ligados por rotas aa outra metade (o
+/// separador) recebem o nivel atual. As metades sem o separador sao divididas
+/// recursivamente. Os pontos sao ordenados por nivel e, no mesmo nivel, pelo numero
+/// de rotas. Em mapas rodoviarios, os separadores sao os pontos pelos quais passa a
+/// maior parte dos caminhos mais curtos.
+vector<HandlePonto> Planejador::ordemRotulos() const
+{
+    const int NP = numPontos();
+    vector<int> nivel(NP, 0);
+    vector<int> lado(NP, -1);
+    int marcador = 0;
+
+    vector<pair<vector<HandlePonto>,int>> pilha;
+    pilha.emplace_back(vector<HandlePonto>(NP), 0);
+    for (int v=0; v<NP; ++v) pilha.back().first[v] = v;
+    while (!pilha.empty())
+    {
+        vector<HandlePonto> conjunto = move(pilha.back().first);
+        int prof = pilha.back().second;
+        pilha.pop_back();
+        if (conjunto.size() <= 2)
+        {
+            for (HandlePonto v : conjunto) nivel[v] = prof;
+            continue;
+        }
+
+        // Divide pela mediana da coordenada de maior extensao
+        auto lat = minmax_element(conjunto.begin(), conjunto.end(), [this](HandlePonto a, HandlePonto b)
+        {
+            return latitude[a] < latitude[b];
+        });
+        auto lon = minmax_element(conjunto.begin(), conjunto.end(), [this](HandlePonto a, HandlePonto b)
+        {
+            return longitude[a] < longitude[b];
+        });
+        const vector<double>& coord =
+            (latitude[*lat.second]-latitude[*lat.first] > longitude[*lon.second]-longitude[*lon.first] ?
+             latitude : longitude);
+        auto meio = conjunto.begin() + conjunto.size()/2;
+        nth_element(conjunto.begin(), meio, conjunto.end(), [&coord](HandlePonto a, HandlePonto b)
+        {
+            return coord[a] < coord[b];
+        });
+
+        // Separador: pontos da 1a metade com rota para a 2a metade
+        const int lado_a = marcador++;
+        const int lado_b = marcador++;
+        for (auto itr=conjunto.begin(); itr!=meio; ++itr) lado[*itr] = lado_a;
+        for (auto itr=meio; itr!=conjunto.end(); ++itr) lado[*itr] = lado_b;
+        vector<HandlePonto> A, B(meio, conjunto.end());
+        for (auto itr=conjunto.begin(); itr!=meio; ++itr)
+        {
+            bool separador = false;
+            for (int k=inicioAdj[*itr]; k<inicioAdj[*itr+1] && !separador; ++k)
             {
+                separador = (lado[vizinhoAdj[k]] == lado_b);
+            }
+            if (separador) nivel[*itr] = prof;
+            else A.push_back(*itr);
+        }
+        pilha.emplace_back(move(A), prof+1);
+        pilha.emplace_back(move(B), prof+1);
+    }
 
-                // Gera sucessor de "atual"
-                auto suc_itr = rotas.begin();
-                while(suc_itr!= rotas.end())  // Repita  DO WHILE
+    vector<HandlePonto> ordem(NP);
+    for (int v=0; v<NP; ++v) ordem[v] = v;
+    stable_sort(ordem.begin(), ordem.end(), [this,&nivel](HandlePonto a, HandlePonto b)
+    {
+        if (nivel[a] != nivel[b]) return nivel[a] < nivel[b];
+        return inicioAdj[a+1]-inicioAdj[a] > inicioAdj[b+1]-inicioAdj[b];
+    });
+    return ordem;
+}
+
+/// Grava x em B como um inteiro de tamanho variavel: 7 bits por byte, do menos para o
+/// mais significativo, com o bit mais alto indicando que ha mais bytes
+static void gravarVarint(vector<unsigned char>& B, uint32_t x)
+{
+    while (x >= 0x80)
+    {
+        B.push_back(static_cast<unsigned char>(x | 0x80));
+        x >>= 7;
+    }
+    B.push_back(static_cast<unsigned char>(x));
+}
+
+/// Leh um inteiro gravado por gravarVarint a partir de p, avancando p
+static inline uint32_t lerVarint(const unsigned char*& p)
+{
+    uint32_t x = *p++;
+    if (x < 0x80) return x;
+    x &= 0x7F;
+    for (int desloc=7; ; desloc+=7)
+    {
+        uint32_t b = *p++;
+        x |= (b & 0x7F) << desloc;
+        if (b < 0x80) return x;
+    }
+}
+
+/// Constroi o indice de rotulos de hubs por rotulacao por marcos podada.
+/// Os pontos sao processados na ordem dada por ordemRotulos(). Para cada ponto (hub)
+/// eh feita uma busca de Dijkstra que inclui o hub no rotulo dos pontos alcancados,
+/// podada nos pontos cuja distancia jah eh dada pelos rotulos construidos antes.
+void Planejador::construirRotulos()
+{
+    const int NP = numPontos();
+    const double INFINITO = numeric_limits<double>::infinity();
+
+    // Ordem de importancia dos pontos
+    vector<HandlePonto> ordem = ordemRotulos();
+
+    // Rotulos em construcao: os hubs sao incluidos em ordem crescente
+    vector<vector<pair<uint32_t,double>>> rotulo(NP);
+    // Distancia do hub atual aos hubs do seu proprio rotulo (indexado pelo hub)
+    vector<double> dist_hub(NP, INFINITO);
+    // Distancias provisorias da busca de Dijkstra
+    vector<double> dist(NP, INFINITO);
+    vector<HandlePonto> alcancados;
+    using Par = pair<double,HandlePonto>;
+    priority_queue<Par, vector<Par>, greater<Par>> fila;
+
+    for (int k=0; k<NP; ++k)
+    {
+        const HandlePonto raiz = ordem[k];
+        for (const auto& P : rotulo[raiz]) dist_hub[P.first] = P.second;
+
+        dist[raiz] = 0.0;
+        alcancados.push_back(raiz);
+        fila.push(Par(0.0, raiz));
+        while (!fila.empty())
+        {
+            Par topo = fila.top();
+            fila.pop();
+            const double d = topo.first;
+            const HandlePonto v = topo.second;
+            if (d > dist[v]) continue;
+
+            // Poda: a distancia jah eh dada pelos hubs anteriores
+            bool podar = false;
+            for (const auto& P : rotulo[v])
+            {
+                if (dist_hub[P.first] + P.second <= d)
                 {
-                    // Busca prxima Rota conectada a "atual"
-                    suc_itr = find(suc_itr, rotas.end(), atual.id_pt); // Rota == IDPonto
+                    podar = true;
+                    break;
+                }
+            }
+            if (podar) continue;
 
-                    if(suc_itr != rotas.end())  // Se existe rota
-                    {
-                        Rota rota_suc = *suc_itr; // rota_suc recebe a rota encontrada pelo iterador
-                        // Gera Noh sucessor
-                        Noh suc;
-                        // Suc.id_pt deve ser igual a extremidade da rota encontrada diferente da atual
-                        if(rota_suc.extremidade[0] == atual.id_pt)
-                        {
-                            suc.id_pt = rota_suc.extremidade[1];
-                        }
-                        else
-                        {
-                            suc.id_pt = rota_suc.extremidade[0];
-                        }
-
-                        // Ponto cuja id == suc.id_pt
-                        Ponto pt_suc = getPonto(suc.id_pt);
-                        suc.id_rt = rota_suc.id;
-                        suc.g = atual.g + rota_suc.comprimento;
-                        suc.h = haversine(pt_suc, pt_dest);
-
-                        // Inicialmente assume que no existe Noh igual a "suc" nos contineres
-                        bool eh_inedito = true;
-                        // Procura Noh igual a "suc" em fechado
-                        auto old_itr = find(Fechado.begin(), Fechado.end(), suc.id_pt); // operador= (Noh = IDPonto)
-                        if(old_itr != Fechado.end())
-                        {
-                            eh_inedito = false;   // Noh j existe
-                        }
-                        else
-                        {
-                            // Procura Noh igual a "suc" em aberto
-                            auto old_itr = find(Aberto.begin(), Aberto.end(), suc.id_pt);
-                            if(old_itr != Aberto.end())
-                            {
-                                //Menor custo total?
-                                Noh old = *old_itr;
-                                if(suc.f() < old.f())
-                                {
-                                    // Exclui anterior
-                                    Aberto.erase(old_itr);
-                                }
-                                else
-                                {
-                                    // Noh j existe
-                                    eh_inedito = false;
-                                }
-                            }
-                        }
-                        // J existe?
-                        if(eh_inedito)
-                        {
-                            // Acha "big", 1 Noh de Aber com custo total f() maior que o custo total f() de "suc"
-                            auto big_itr = upper_bound(Aberto.begin(), Aberto.end(), suc); // operador < (Noh < Noh)
-                            Aberto.insert(big_itr, suc);
-                        }
-                        ++suc_itr;
-                    }
+            rotulo[v].push_back(pair<uint32_t,double>(k, d));
+            for (int j=inicioAdj[v]; j<inicioAdj[v+1]; ++j)
+            {
+                const HandlePonto w = vizinhoAdj[j];
+                const double dw = d + comprimento[rotaAdj[j]];
+                if (dw < dist[w])
+                {
+                    if (dist[w] == INFINITO) alcancados.push_back(w);
+                    dist[w] = dw;
+                    fila.push(Par(dw, w));
                 }
             }
         }
 
-        // Calcula nmeros de ns da busca
-        NA = Aberto.size();
-        NF = Fechado.size();
+        for (HandlePonto v : alcancados) dist[v] = INFINITO;
+        alcancados.clear();
+        for (const auto& P : rotulo[raiz]) dist_hub[P.first] = INFINITO;
+    }
+
+    // Grava os rotulos comprimidos, cada um terminado por um byte 0
+    inicioRotulo.assign(NP+1, 0);
+    rotulos.clear();
+    paresRotulos = 0;
+    for (int v=0; v<NP; ++v)
+    {
+        uint32_t anterior = UINT32_MAX; // O primeiro hub eh gravado como hub+1
+        for (const auto& P : rotulo[v])
+        {
+            gravarVarint(rotulos, P.first - anterior);
+            anterior = P.first;
+            float d = static_cast<float>(P.second);
+            const unsigned char* b = reinterpret_cast<const unsigned char*>(&d);
+            rotulos.insert(rotulos.end(), b, b+sizeof(float));
+        }
+        rotulos.push_back(0);
+        inicioRotulo[v+1] = rotulos.size();
+        paresRotulos += rotulo[v].size();
+        vector<pair<uint32_t,double>>().swap(rotulo[v]);
+    }
+    rotulos.shrink_to_fit();
+}
+
+/// Calcula apenas a distancia entre origem e destino, pelos rotulos de hubs
+/// (se construidos) ou pelo algoritmo A*
+double Planejador::calculaDistancia(const IDPonto& id_origem,
+                                    const IDPonto& id_destino) const
+{
+    const HandlePonto orig = getHandle(id_origem);
+    const HandlePonto dest = getHandle(id_destino);
+    if (!temRotulos() || orig == HANDLE_NULO || dest == HANDLE_NULO)
+    {
+        CaminhoCompacto C;
+        int NA, NF;
+        return calculaCaminho(id_origem, id_destino, C, NA, NF);
+    }
+    if (componente[orig] != componente[dest]) return -1.0;
+    return distanciaRotulos(orig, dest);
+}
 
-        // Inicialmente, caminho vazio
-        //stack<Noh> caminho;
-        double compr;
-        // Encontrou soluo ou no?
-        if(atual.id_pt != id_destino) compr = -1.0; // No existe soluo
+/// Distancia entre dois pontos pela intersecao dos rotulos de hubs
+double Planejador::distanciaRotulos(HandlePonto orig, HandlePonto dest) const
+{
+    // Intersecao dos rotulos: o menor d(orig,hub)+d(hub,dest) entre os hubs comuns.
+    // Os hubs sao reconstruidos somando as diferencas; a intercalacao termina no
+    // fim (diferenca 0) de qualquer um dos rotulos.
+    double menor = numeric_limits<double>::infinity();
+    const unsigned char* p = rotulos.data() + inicioRotulo[orig];
+    const unsigned char* q = rotulos.data() + inicioRotulo[dest];
+    uint32_t dp = lerVarint(p), dq = lerVarint(q);
+    uint32_t hp = UINT32_MAX + dp, hq = UINT32_MAX + dq;
+    while (dp != 0 && dq != 0)
+    {
+        if (hp == hq)
+        {
+            float a, b;
+            memcpy(&a, p, sizeof(float));
+            memcpy(&b, q, sizeof(float));
+            menor = min(menor, double(a) + double(b));
+            p += sizeof(float);
+            q += sizeof(float);
+            dp = lerVarint(p);
+            dq = lerVarint(q);
+            hp += dp;
+            hq += dq;
+        }
+        else if (hp < hq)
+        {
+            p += sizeof(float);
+            dp = lerVarint(p);
+            hp += dp;
+        }
         else
         {
-            // Calcula comprimento do caminho
-            compr = atual.g;
-            // Refaz o caminho, procurando Nohs antecessores em fechado
-            while(atual.id_rt != IDRota())
+            q += sizeof(float);
+            dq = lerVarint(q);
+            hq += dq;
+        }
+    }
+    return (menor < numeric_limits<double>::infinity() ? menor : -1.0);
+}
+
+/* *************************
+   * ITINERARIOS           *
+   ************************* */
+
+/// Custos dos caminhos de menor custo entre todos os pares de pontos fornecidos.
+/// Cada thread faz buscas de Dijkstra (A* sem custo futuro) a partir de uma parte dos
+/// pontos, reaproveitando os mesmos dados de busca. A busca a partir do ponto i
+/// continua ateh alcancar todos os pontos seguintes da lista: como as rotas podem ser
+/// percorridas nos dois sentidos, os custos sao simetricos.
+void Planejador::custosEntre(const vector<HandlePonto>& pts, const Pesos& pesos,
+                             unsigned num_threads, vector<double>& D) const
+{
+    const int N = pts.size();
+    D.assign(size_t(N)*N, 0.0);
+
+    // Soh o comprimento importa: distancias pelos rotulos de hubs
+    if (pesos.soComprimento() && temRotulos())
+    {
+        for (int i=0; i<N; ++i)
+        {
+            for (int j=i+1; j<N; ++j)
             {
-                // Acrescenta par atual no topo (incio) de "caminho"
-                C.push_front(pair(atual.id_rt, atual.id_pt));
-
-                // Recupera o antecessor
-                // Obtm "rota_ant", Rota que levou at "atual"
-                Rota rota_ant = getRota(atual.id_rt);
-                // Calcula a id do antecessor
-                IDPonto id_pt_ant;
-                if(rota_ant.extremidade[0] == atual.id_pt)
+                D[size_t(i)*N+j] = D[size_t(j)*N+i] = distanciaRotulos(pts[i], pts[j]);
+            }
+        }
+        return;
+    }
+
+    // As threads pegam o proximo ponto de origem ateh que acabem
+    atomic<int> proximo(0);
+    executarEmParalelo(min<unsigned>(num_threads, max(N-1, 1)), [&](unsigned)
+    {
+        BuscaAEstrela busca;
+        for (int i=proximo++; i<N-1; i=proximo++)
+        {
+            busca.iniciar(numPontos(), pts[i]);
+            comPesos(pesos, [&](const auto& custo, double)
+            {
+                for (int j=i+1; j<N; ++j)
                 {
-                    id_pt_ant = rota_ant.extremidade[1];
+                    buscaAEstrela(busca, pts[j], custo, 0.0);
+                    D[size_t(i)*N+j] = D[size_t(j)*N+i] = busca.g[pts[j]];
                 }
-                else
+                return 0.0;
+            });
+        }
+    });
+}
+
+/// Ordem de visita dos pontos de um itinerario, dados os custos simetricos D[i*N+j]
+/// entre os N pontos. O itinerario comeca no ponto 0 e termina no ponto N-1, se
+/// fim_fixo==true, ou em qualquer parada. Usa a heuristica da insercao do mais
+/// proximo, melhorada por 2-opt e Or-opt ateh que nenhum movimento reduza o custo.
+/// Retorna a sequencia de pontos, a partir do ponto 0.
+static vector<int> ordenarParadas(const vector<double>& D, int N, bool fim_fixo)
+{
+    const double INFINITO = numeric_limits<double>::infinity();
+    // Diferenca minima de custo entre duas escolhas. Em um mapa, empates exatos sao
+    // comuns (uma parada no caminho entre outras duas); com a tolerancia, o empate
+    // eh decidido pela ordem das alternativas, e nao por erros de arredondamento.
+    const double EPS = 1e-9;
+    // Sem fim fixo, o itinerario termina em um ponto virtual (N) com custo 0 a partir
+    // de qualquer ponto, que eh retirado no final
+    const int fim = (fim_fixo ? N-1 : N);
+    const int num_paradas = (fim_fixo ? N-2 : N-1); // Paradas: pontos 1 ... num_paradas
+    auto d = [&D,N](int a, int b)
+    {
+        return (a == N || b == N ? 0.0 : D[size_t(a)*N+b]);
+    };
+
+    // Insercao do mais proximo: a cada passo, a parada mais proxima do itinerario eh
+    // incluida na posicao em que menos aumenta o custo
+    vector<int> seq = {0, fim};
+    vector<char> incluida(N, false);
+    vector<double> proximidade(N, INFINITO);
+    for (int k=1; k<=num_paradas; ++k)
+    {
+        proximidade[k] = (fim_fixo ? min(d(0,k), d(fim,k)) : d(0,k));
+    }
+    for (int passo=0; passo<num_paradas; ++passo)
+    {
+        int k = -1;
+        for (int j=1; j<=num_paradas; ++j)
+        {
+            if (!incluida[j] && (k < 0 || proximidade[j] < proximidade[k] - EPS)) k = j;
+        }
+        size_t melhor = 1;
+        double menor = INFINITO;
+        for (size_t p=1; p<seq.size(); ++p)
+        {
+            double acrescimo = d(seq[p-1],k) + d(k,seq[p]) - d(seq[p-1],seq[p]);
+            if (acrescimo < menor - EPS)
+            {
+                menor = acrescimo;
+                melhor = p;
+            }
+        }
+        seq.insert(seq.begin()+melhor, k);
+        incluida[k] = true;
+        for (int j=1; j<=num_paradas; ++j) proximidade[j] = min(proximidade[j], d(k,j));
+    }
+
+    // Melhorias locais. O primeiro e o ultimo pontos nunca mudam de lugar.
+    const int M = seq.size();
+    bool melhorou = true;
+    while (melhorou)
+    {
+        melhorou = false;
+
+        // 2-opt: inverte a ordem das paradas seq[i] ... seq[j]
+        for (int i=1; i<M-2; ++i)
+        {
+            for (int j=i+1; j<M-1; ++j)
+            {
+                double delta = d(seq[i-1],seq[j]) + d(seq[i],seq[j+1]) -
+                               d(seq[i-1],seq[i]) - d(seq[j],seq[j+1]);
+                if (delta < -EPS)
                 {
-                    id_pt_ant = rota_ant.extremidade[0];
+                    reverse(seq.begin()+i, seq.begin()+j+1);
+                    melhorou = true;
                 }
+            }
+        }
 
-                // Procura Noh igual a "id_pt_ant" em Fechado
-                auto antecessor = find(Fechado.begin(), Fechado.end(), id_pt_ant); // Noh == IDPonto
-                atual = *antecessor;
+        // Or-opt: move as paradas seq[i] ... seq[i+L-1] (L de 1 a 3) para entre
+        // seq[p] e seq[p+1], na mesma ordem ou invertidas
+        for (int L=1; L<=3; ++L)
+        {
+            for (int i=1; i+L<M; ++i)
+            {
+                const int a = seq[i-1], s0 = seq[i], s1 = seq[i+L-1], b = seq[i+L];
+                const double ganho = d(a,s0) + d(s1,b) - d(a,b);
+                for (int p=0; p<M-1; ++p)
+                {
+                    if (p >= i-1 && p < i+L) continue;
+                    const int c = seq[p], e = seq[p+1];
+                    const double direto = d(c,s0) + d(s1,e) - d(c,e);
+                    const double invertido = d(c,s1) + d(s0,e) - d(c,e);
+                    if (min(direto,invertido) - ganho < -EPS)
+                    {
+                        vector<int> trecho(seq.begin()+i, seq.begin()+i+L);
+                        if (invertido < direto) reverse(trecho.begin(), trecho.end());
+                        seq.erase(seq.begin()+i, seq.begin()+i+L);
+                        const int pos = (p < i ? p+1 : p+1-L);
+                        seq.insert(seq.begin()+pos, trecho.begin(), trecho.end());
+                        melhorou = true;
+                        break;
+                    }
+                }
             }
-            // Acrescenta origem no topo (incio) de "caminho"
-            C.push_front(pair(atual.id_rt, atual.id_pt));
         }
+    }
+
+    if (!fim_fixo) seq.pop_back();
+    return seq;
+}
+
+/// Calcula um itinerario sem ponto final fixo
+double Planejador::calculaItinerario(const IDPonto& id_origem,
+                                     const vector<IDPonto>& paradas,
+                                     Itinerario& I, const Pesos& pesos,
+                                     unsigned num_threads) const
+{
+    return calculaItinerario(id_origem, paradas, IDPonto(), I, pesos, num_threads);
+}
+
+/// Calcula um itinerario que parte da origem, passa por todas as paradas e termina
+/// em id_fim, se valida. Retorna o custo total do itinerario.
+double Planejador::calculaItinerario(const IDPonto& id_origem,
+                                     const vector<IDPonto>& paradas,
+                                     const IDPonto& id_fim, Itinerario& I,
+                                     const Pesos& pesos, unsigned num_threads) const
+{
+    // Zera o itinerario resultado
+    I.clear();
+    I.caminho.mapa = this;
+
+    try
+    {
+        // Mapa vazio
+        if (empty()) throw 1;
+
+        // Pontos do itinerario: origem, paradas e fim fixo (se houver).
+        // Se a origem nao existir, throw 4; se uma parada ou o fim nao existir, throw 5
+        vector<HandlePonto> pts;
+        pts.push_back(getHandle(id_origem));
+        if (pts[0] == HANDLE_NULO) throw 4;
+        for (const auto& id : paradas)
+        {
+            pts.push_back(getHandle(id));
+            if (pts.back() == HANDLE_NULO) throw 5;
+        }
+        const bool fim_fixo = id_fim.valid();
+        if (fim_fixo)
+        {
+            pts.push_back(getHandle(id_fim));
+            if (pts.back() == HANDLE_NULO) throw 5;
+        }
+
+        // Pesos negativos
+        if (!pesos.valid()) throw 6;
 
-        // O try tem que terminar retornando o comprimento calculado
-        return compr;  // SUBSTITUA pelo return do valor correto
+        // Algum ponto em outro componente conexo: nao existe itinerario
+        for (HandlePonto v : pts)
+        {
+            if (componente[v] != componente[pts[0]]) return -1.0;
+        }
+
+        if (num_threads == 0) num_threads = max(thread::hardware_concurrency(), 1u);
+
+        // Ordem das paradas, pelos custos entre todos os pares de pontos
+        vector<double> D;
+        custosEntre(pts, pesos, num_threads, D);
+        const vector<int> seq = ordenarParadas(D, pts.size(), fim_fixo);
+
+        // Caminho de cada trecho, em paralelo
+        const int num_trechos = seq.size()-1;
+        vector<CaminhoCompacto> caminhos(num_trechos);
+        atomic<int> proximo(0);
+        executarEmParalelo(min<unsigned>(num_threads, max(num_trechos, 1)), [&](unsigned)
+        {
+            BuscaAEstrela busca;
+            for (int k=proximo++; k<num_trechos; k=proximo++)
+            {
+                const HandlePonto dest = pts[seq[k+1]];
+                busca.iniciar(numPontos(), pts[seq[k]]);
+                comPesos(pesos, [&](const auto& custo, double fator_h)
+                {
+                    buscaAEstrela(busca, dest, custo, fator_h);
+                    return 0.0;
+                });
+                montarCaminho(busca, dest, caminhos[k], false);
+            }
+        });
+
+        // Junta os trechos: cada trecho comeca no ponto em que o anterior termina
+        CaminhoCompacto& C = I.caminho;
+        C.etapas.push_back(Etapa(HANDLE_NULO, pts[0]));
+        C.compr = C.custo = 0.0;
+        I.trechos.resize(num_trechos);
+        for (int k=0; k<num_trechos; ++k)
+        {
+            TrechoItinerario& T = I.trechos[k];
+            T.parada = (seq[k+1] <= int(paradas.size()) ? seq[k+1]-1 : -1);
+            T.inicio = C.etapas.size()-1;
+            C.etapas.insert(C.etapas.end(), caminhos[k].etapas.begin()+1, caminhos[k].etapas.end());
+            T.fim = C.etapas.size()-1;
+            T.comprimento = caminhos[k].compr;
+            T.custo = caminhos[k].custo;
+            C.compr += T.comprimento;
+            C.custo += T.custo;
+        }
+        return C.custo;
     }
     catch(int i)
     {
-        cerr << "Erro " << i << " no calculo do caminho\n";
+        cerr << "Erro " << i << " no calculo do itinerario\n";
     }
 
-    // Soh chega aqui se executou o catch, jah que o try termina sempre com return.
-    // Caminho C permanece vazio.
-    NA = NF = -1;
+    // Soh chega aqui se executou o catch. Itinerario I permanece vazio.
     return -1.0;
 }
+
+/* ****************************
+   * CLASSE EXECUTORCONSULTAS *
+   **************************** */
+
+/// Uma consulta submetida ao executor, aguardando uma thread
+struct Consulta
+{
+    IDPonto origem;
+    IDPonto destino;
+    Pesos pesos;
+    Limites limites;
+    bool acumulado;
+    promise<ResultadoConsulta> resultado;
+};
+
+/// Fila de consultas compartilhada entre as submissoes e as threads de calculo
+class FilaConsultas: public FilaBloqueante<Consulta>
+{
+};
+
+/// Cria um executor de consultas no mapa G com num_threads threads
+ExecutorConsultas::ExecutorConsultas(const Planejador& G, unsigned num_threads):
+    mapa(&G), fila(new FilaConsultas), threads()
+{
+    if (num_threads == 0) num_threads = max(thread::hardware_concurrency(), 1u);
+    for (unsigned i=0; i<num_threads; ++i)
+    {
+        threads.emplace_back(&ExecutorConsultas::trabalhar, this);
+    }
+}
+
+/// Conclui as consultas da fila como CANCELADA e espera as threads terminarem
+ExecutorConsultas::~ExecutorConsultas()
+{
+    fila->encerrar([](Consulta& Q)
+    {
+        ResultadoConsulta R;
+        R.estado = EstadoConsulta::CANCELADA;
+        R.NA = R.NF = 0;
+        Q.resultado.set_value(move(R));
+    });
+    for (auto& T : threads) T.join();
+}
+
+/// Submete uma consulta de caminho. O resultado fica disponivel no future retornado.
+future<ResultadoConsulta> ExecutorConsultas::submeter(const IDPonto& id_origem,
+                                                      const IDPonto& id_destino,
+                                                      const Pesos& pesos,
+                                                      const Limites& limites,
+                                                      bool acumulado)
+{
+    Consulta Q{id_origem, id_destino, pesos, limites, acumulado, promise<ResultadoConsulta>()};
+    future<ResultadoConsulta> F = Q.resultado.get_future();
+    fila->incluir(move(Q));
+    return F;
+}
+
+/// Thread de calculo: atende as consultas da fila ateh que ela seja encerrada.
+/// Uma consulta cancelada ou expirada na fila eh concluida por calculaCaminho
+/// antes de iniciar a busca.
+void ExecutorConsultas::trabalhar()
+{
+    Consulta Q;
+    while (fila->retirar(Q))
+    {
+        try
+        {
+            ResultadoConsulta R;
+            R.estado = mapa->calculaCaminho(Q.origem, Q.destino, R.caminho, R.NA, R.NF,
+                                            Q.pesos, Q.limites, Q.acumulado);
+            Q.resultado.set_value(move(R));
+        }
+        catch (...)
+        {
+            // Falta de memoria, por exemplo: repassa a excecao a quem espera o resultado
+            Q.resultado.set_exception(current_exception());
+        }
+    }
+}
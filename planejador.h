@@ -2,7 +2,21 @@
 #define _PLANEJADOR_H_
 
 #include <string>
+#include <string_view>
 #include <list>
+#include <vector>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <cstdint>
+#include <climits>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 
 /* *************************
    * CLASSE IDPONTO        *
@@ -23,6 +37,11 @@ public:
     {
         return (t.size()>=2 && t[0]=='#');
     }
+    // Texto da id (usado nas tabelas de hash)
+    const std::string& str() const
+    {
+        return t;
+    }
     // Comparacao
     bool operator==(const IDPonto& ID) const
     {
@@ -58,6 +77,11 @@ public:
     {
         return (t.size()>=2 && t[0]=='&');
     }
+    // Texto da id (usado nas tabelas de hash)
+    const std::string& str() const
+    {
+        return t;
+    }
     // Comparacao
     bool operator==(const IDRota& ID) const
     {
@@ -74,6 +98,25 @@ public:
     }
 };
 
+/// Funcoes de hash das ids, para uso em std::unordered_set e std::unordered_map
+namespace std
+{
+template<> struct hash<IDPonto>
+{
+    size_t operator()(const IDPonto& ID) const
+    {
+        return hash<string>()(ID.str());
+    }
+};
+template<> struct hash<IDRota>
+{
+    size_t operator()(const IDRota& ID) const
+    {
+        return hash<string>()(ID.str());
+    }
+};
+}
+
 /* *************************
    * CLASSE PONTO          *
    ************************* */
@@ -120,9 +163,14 @@ struct Rota
     std::string nome;       // Denominacao usual da rota
     IDPonto extremidade[2]; // Ids dos pontos extremos da rota
     double comprimento;     // Comprimento da rota (em km)
+    // Atributos opcionais (colunas extras do arquivo de rotas; 0 se ausentes)
+    double tempo;           // Tempo de percurso (em h)
+    double pedagio;         // Valor total dos pedagios
+    int classe;             // Classe da via (de 0 a 255; maior eh pior)
 
     // Construtor default
-    Rota(): id(), nome(""), extremidade(), comprimento(0.0) {}
+    Rota(): id(), nome(""), extremidade(), comprimento(0.0),
+        tempo(0.0), pedagio(0.0), classe(0) {}
     // Teste de validade
     bool valid() const
     {
@@ -157,6 +205,270 @@ struct Rota
 /// No ultimo elemento, o ponto eh o destino.
 using Caminho = std::list< std::pair<IDRota,IDPonto> >;
 
+/* *************************
+   * HANDLES               *
+   ************************* */
+
+/// Handles: posicao de um ponto ou de uma rota no indice do Planejador.
+/// Permitem acessar os dados de um ponto ou rota em O(1), sem buscas por id.
+/// Sao validos enquanto o mapa nao for alterado (ler, lerParalelo, clear).
+using HandlePonto = int;
+using HandleRota = int;
+/// Handle que nao corresponde a nenhum ponto ou rota
+constexpr int HANDLE_NULO = -1;
+
+/* *************************
+   * COMPONENTE            *
+   ************************* */
+
+/// Um componente conexo do mapa: conjunto de pontos ligados entre si por rotas.
+/// Nao existe caminho entre pontos de componentes diferentes.
+struct Componente
+{
+    HandlePonto representante; // Primeiro ponto do componente (na ordem dos pontos)
+    int num_pontos;            // Numero de pontos do componente
+    int num_rotas;             // Numero de rotas do componente
+    double comprimento;        // Soma dos comprimentos das rotas do componente (em km)
+
+    Componente(HandlePonto h=HANDLE_NULO):
+        representante(h), num_pontos(0), num_rotas(0), comprimento(0.0) {}
+};
+
+class CaminhoCompacto;
+class BuscaAEstrela;
+class Itinerario;
+
+/* *************************
+   * PESOS                 *
+   ************************* */
+
+/// Pesos dos atributos das rotas no custo de um caminho.
+/// O custo de uma rota eh a combinacao linear
+///   comprimento*C + tempo*T + pedagio*P + classe*comprimento*K
+/// (a classe penaliza cada km percorrido em vias piores).
+/// Os pesos nao podem ser negativos. O default considera apenas o comprimento.
+struct Pesos
+{
+    double comprimento;
+    double tempo;
+    double pedagio;
+    double classe;
+
+    Pesos(double C=1.0, double T=0.0, double P=0.0, double K=0.0):
+        comprimento(C), tempo(T), pedagio(P), classe(K) {}
+    // Teste de validade
+    bool valid() const
+    {
+        return (comprimento>=0.0 && tempo>=0.0 && pedagio>=0.0 && classe>=0.0);
+    }
+    // Testa se o custo eh apenas o comprimento
+    bool soComprimento() const
+    {
+        return (comprimento==1.0 && tempo==0.0 && pedagio==0.0 && classe==0.0);
+    }
+};
+
+/* *************************
+   * LIMITES DE CONSULTA   *
+   ************************* */
+
+/// Estado do termino de uma consulta de caminho
+enum class EstadoConsulta
+{
+    OK,          // Caminho encontrado
+    SEM_CAMINHO, // Nao existe caminho entre a origem e o destino
+    INVALIDA,    // Parametros invalidos
+    EXPIRADA,    // O prazo terminou antes do fim da busca
+    CANCELADA    // A consulta foi cancelada antes do fim da busca
+};
+
+/// Token de cancelamento cooperativo de consultas. As copias de um token
+/// compartilham o mesmo estado: cancelar uma copia, em qualquer thread, cancela
+/// as consultas que receberam qualquer outra copia do mesmo token.
+class Cancelamento
+{
+private:
+    std::shared_ptr<std::atomic<bool>> sinal;
+
+public:
+    Cancelamento(): sinal(std::make_shared<std::atomic<bool>>(false)) {}
+
+    /// Pede o cancelamento das consultas que usam o token
+    void cancelar()
+    {
+        sinal->store(true, std::memory_order_relaxed);
+    }
+    /// Testa se o cancelamento foi pedido
+    bool cancelado() const
+    {
+        return sinal->load(std::memory_order_relaxed);
+    }
+};
+
+/// Limites de uma consulta: prazo para o termino e token de cancelamento.
+/// A busca A* verifica os limites a cada INTERVALO nohs expandidos e eh
+/// interrompida se o prazo terminou ou se a consulta foi cancelada.
+struct Limites
+{
+    using Relogio = std::chrono::steady_clock;
+
+    /// Numero de nohs expandidos entre duas verificacoes dos limites
+    static constexpr int INTERVALO = 1024;
+
+    Relogio::time_point prazo;  // Instante limite (max() se nao ha prazo)
+    Cancelamento cancelamento;  // Token de cancelamento da consulta
+
+    /// Sem prazo, com um novo token de cancelamento
+    Limites(): prazo(Relogio::time_point::max()), cancelamento() {}
+    /// Prazo a partir de agora e token de cancelamento fornecidos.
+    /// Um prazo que ultrapassa o maior instante do relogio equivale a nao ter prazo.
+    explicit Limites(Relogio::duration tempo, const Cancelamento& C = Cancelamento()):
+        prazo(somar(Relogio::now(), tempo)), cancelamento(C) {}
+    /// Sem prazo, com o token de cancelamento fornecido
+    explicit Limites(const Cancelamento& C):
+        prazo(Relogio::time_point::max()), cancelamento(C) {}
+
+    /// Instante t+tempo, saturado em time_point::max() em vez de estourar
+    static Relogio::time_point somar(Relogio::time_point t, Relogio::duration tempo)
+    {
+        if (tempo > Relogio::time_point::max() - t) return Relogio::time_point::max();
+        return t + tempo;
+    }
+
+    /// Retorna CANCELADA ou EXPIRADA se a consulta deve ser interrompida; senao, OK
+    EstadoConsulta verificar() const
+    {
+        if (cancelamento.cancelado()) return EstadoConsulta::CANCELADA;
+        if (prazo != Relogio::time_point::max() && Relogio::now() >= prazo)
+        {
+            return EstadoConsulta::EXPIRADA;
+        }
+        return EstadoConsulta::OK;
+    }
+};
+
+/* *************************
+   * CLASSE POOLTEXTOS     *
+   ************************* */
+
+/// Conjunto de textos guardados em sequencia em um unico bloco de memoria, sem a
+/// sobrecarga de um std::string (e de uma alocacao) por texto. Cada texto eh
+/// identificado pelo seu indice, na ordem de inclusao; um texto incluido mais de uma
+/// vez eh guardado uma unica vez. Os inicios dos textos e os indices tem 32 bits: uma
+/// inclusao que ultrapassaria MAX_CARACTERES ou MAX_TEXTOS falha sem alterar o conjunto.
+class PoolTextos
+{
+private:
+    std::vector<char> dados;      // Textos concatenados, sem separadores
+    std::vector<uint32_t> inicio; // O texto i ocupa dados[inicio[i]] ... dados[inicio[i+1]-1]
+    // Tabela de hash com enderecamento aberto, dividida em partes independentes pelo
+    // resto do hash: as partes podem ser preenchidas em paralelo. Cada posicao de uma
+    // parte guarda indice+1 de um texto ou 0 (posicao livre).
+    struct Parte
+    {
+        std::vector<uint32_t> tabela;
+        size_t ocupadas; // Posicoes nao livres
+
+        Parte(): tabela(), ocupadas(0) {}
+    };
+    static constexpr unsigned NUM_PARTES = 64;
+    std::vector<Parte> partes;
+
+    /// Parte da tabela de um texto com hash h
+    Parte& parte(size_t h)
+    {
+        return partes[h % NUM_PARTES];
+    }
+    /// Posicao do texto S, com hash h, na parte P: a que contem S ou a posicao livre
+    /// onde S seria incluido. texto(i) eh o texto de indice i.
+    template<class Texto>
+    static size_t posicao(const Parte& P, size_t h, std::string_view S, const Texto& texto);
+    /// Aumenta a parte P, reinserindo os seus textos, para que caibam nela ocupadas
+    /// textos com no maximo 3/4 das posicoes ocupadas
+    template<class Texto>
+    static void aumentar(Parte& P, size_t ocupadas, const Texto& texto);
+
+public:
+    /// Total maximo de caracteres e numero maximo de textos (procurar retorna int)
+    static constexpr size_t MAX_CARACTERES = UINT32_MAX;
+    static constexpr size_t MAX_TEXTOS = INT_MAX;
+    /// Retorno das inclusoes quando os textos novos nao cabem no conjunto
+    static constexpr size_t NAO_CABE = SIZE_MAX;
+
+    /// Cria um conjunto vazio
+    PoolTextos(): dados(), inicio(1, 0), partes(NUM_PARTES) {}
+
+    /// Construtor e atribuicao por copia
+    PoolTextos(const PoolTextos&) = default;
+    PoolTextos& operator=(const PoolTextos&) = default;
+    /// Construtor e atribuicao por movimento. O conjunto movido fica vazio e valido:
+    /// as consultas pressupoem o inicio do primeiro texto e as partes da tabela
+    PoolTextos(PoolTextos&& P): dados(std::move(P.dados)), inicio(std::move(P.inicio)),
+        partes(std::move(P.partes))
+    {
+        P.clear();
+    }
+    PoolTextos& operator=(PoolTextos&& P)
+    {
+        if (this != &P)
+        {
+            dados = std::move(P.dados);
+            inicio = std::move(P.inicio);
+            partes = std::move(P.partes);
+            P.clear();
+        }
+        return *this;
+    }
+
+    /// Torna o conjunto vazio
+    void clear();
+
+    /// Numero de textos
+    size_t size() const
+    {
+        return inicio.size()-1;
+    }
+
+    /// Indica se cabem no conjunto mais num_textos textos, com num_caracteres no total
+    bool cabe(size_t num_textos, size_t num_caracteres) const
+    {
+        return num_textos <= MAX_TEXTOS-size() && num_caracteres <= MAX_CARACTERES-dados.size();
+    }
+
+    /// Texto de indice i
+    std::string_view operator[](uint32_t i) const
+    {
+        return std::string_view(dados.data()+inicio[i], inicio[i+1]-inicio[i]);
+    }
+
+    /// Retorna o indice do texto S, incluindo-o se ainda nao existir.
+    /// Retorna NAO_CABE, sem incluir, se S eh novo e nao cabe no conjunto.
+    size_t incluir(std::string_view S);
+
+    /// Coloca em indices o indice de cada texto de S, incluindo os que ainda nao
+    /// existirem, na ordem de S. As partes da tabela de hash sao preenchidas em
+    /// paralelo por num_threads threads.
+    /// Retorna a posicao em S do primeiro texto que jah existia no conjunto ou que
+    /// aparece antes em S (S.size() se nao houver repeticoes), ou NAO_CABE, sem
+    /// incluir nenhum texto, se os textos novos nao cabem no conjunto.
+    size_t incluir(const std::vector<std::string_view>& S,
+                   std::vector<uint32_t>& indices, unsigned num_threads);
+
+    /// Retorna o indice do texto S, ou -1 se ele nao existir
+    int procurar(std::string_view S) const;
+
+    /// Libera a memoria reservada durante as inclusoes e nao usada
+    void ajustar();
+
+    /// Memoria ocupada (em bytes)
+    size_t memoria() const
+    {
+        size_t total = dados.capacity() + inicio.capacity()*sizeof(uint32_t);
+        for (const Parte& P : partes) total += P.tabela.capacity()*sizeof(uint32_t);
+        return total;
+    }
+};
+
 /* *************************
    * CLASSE PLANEJADOR     *
    ************************* */
@@ -166,12 +478,126 @@ using Caminho = std::list< std::pair<IDRota,IDPonto> >;
 class Planejador
 {
 private:
-    std::list<Ponto> pontos;
-    std::list<Rota> rotas;
+    // O mapa eh armazenado em colunas: os dados do ponto ou da rota de handle h
+    // ocupam a posicao h de cada vetor. As ids ficam em um conjunto de textos para os
+    // pontos e outro para as rotas, no qual o indice de cada id eh o handle. Os nomes,
+    // muito repetidos nas rotas, ficam em um unico conjunto, sem repeticoes.
+    PoolTextos idsPontos, idsRotas;                  // Ids (handle <-> id)
+    PoolTextos nomes;                                // Nomes dos pontos e das rotas
+    std::vector<uint32_t> indNomePonto, indNomeRota; // Indice do nome em nomes
+    std::vector<double> latitude, longitude;         // Coordenadas dos pontos
+    std::vector<double> comprimento;                 // Comprimento das rotas
+    std::vector<HandlePonto> extremidade[2];         // Extremidades das rotas
+    // Atributos opcionais das rotas (vazios se ausentes do arquivo de rotas)
+    std::vector<double> tempo, pedagio;
+    std::vector<unsigned char> classe;
+    // Menor razao entre o atributo de uma rota (comprimento, tempo, pedagio e
+    // classe*comprimento) e a distancia em linha reta entre as extremidades: permite
+    // estimar por baixo o custo futuro de um caminho pela distancia em linha reta
+    // ateh o destino. O comprimento de uma rota pode ser menor que a distancia em
+    // linha reta (dados aproximados), entao a razao do comprimento pode ser menor que 1.
+    double razaoMinima[4];
+    // Indice do mapa, refeito sempre que o mapa eh alterado.
+    // Rotas que partem de cada ponto (lista de adjacencia compacta):
+    // as rotas do ponto v estao nas posicoes inicioAdj[v] ... inicioAdj[v+1]-1
+    // de rotaAdj, e vizinhoAdj guarda a outra extremidade de cada rota
+    std::vector<int> inicioAdj;
+    std::vector<HandleRota> rotaAdj;
+    std::vector<HandlePonto> vizinhoAdj;
+    // Componentes conexos: indice do componente de cada ponto e dados de cada componente
+    std::vector<int> componente;
+    std::vector<Componente> componentes;
+    // Rotulos de hubs (opcionais, criados por construirRotulos e descartados quando o
+    // mapa eh alterado). O rotulo do ponto v ocupa os bytes inicioRotulo[v] ...
+    // inicioRotulo[v+1]-1 de rotulos: pares (hub, distancia ateh o hub) em ordem
+    // crescente de hub. Os hubs sao numerados pela ordem de importancia dos pontos.
+    // Cada par eh gravado comprimido: a diferenca para o hub anterior (para o primeiro,
+    // hub+1) em um inteiro de tamanho variavel, com 7 bits por byte, seguida da
+    // distancia em float. Como as diferencas sao >= 1, um byte 0 encerra o rotulo.
+    std::vector<uint64_t> inicioRotulo;
+    std::vector<unsigned char> rotulos;
+    size_t paresRotulos; // Numero total de pares (hub, distancia)
+
+    /// Rota lida de um arquivo, com os handles das extremidades no mapa lido
+    struct RotaLida
+    {
+        Rota rota;
+        HandlePonto extremidade[2];
+    };
+
+    /// Codigo de erro de leitura quando as ids ou os nomes excedem o limite de PoolTextos
+    static const int ERRO_TEXTOS = 17;
+
+    /// Inclui um ponto no final do mapa, sem refazer o indice.
+    /// Retorna 0, 8 (sem incluir) se jah existe ponto com a mesma id ou ERRO_TEXTOS
+    /// se a id ou o nome nao cabem: o mapa fica incompleto e deve ser descartado.
+    int incluir(const Ponto& P);
+    /// Inclui uma rota no final do mapa, sem refazer o indice.
+    /// Os handles das extremidades devem ser de pontos do mapa.
+    /// Retorna 0, 13 (sem incluir) se jah existe rota com a mesma id ou ERRO_TEXTOS
+    /// se a id ou o nome nao cabem: o mapa fica incompleto e deve ser descartado.
+    int incluir(const RotaLida& R);
+    /// Inclui os pontos no final do mapa, na ordem do vetor, sem refazer o indice,
+    /// usando num_threads threads. Retorna 0, 8 se algum ponto tem a mesma id de um
+    /// ponto do mapa ou anterior no vetor ou ERRO_TEXTOS se as ids ou os nomes nao
+    /// cabem: nos dois casos o mapa fica incompleto e deve ser descartado.
+    int incluir(const std::vector<const Ponto*>& P, unsigned num_threads);
+    /// Inclui as rotas no final do mapa, na ordem do vetor, sem refazer o indice,
+    /// usando num_threads threads. Retorna 0, 13 se alguma rota tem a mesma id de uma
+    /// rota do mapa ou anterior no vetor ou ERRO_TEXTOS se as ids ou os nomes nao
+    /// cabem: nos dois casos o mapa fica incompleto e deve ser descartado.
+    int incluir(const std::vector<const RotaLida*>& R, unsigned num_threads);
+
+    /// Refaz o indice (atributos opcionais, adjacencia, componentes) a partir das
+    /// colunas do mapa e libera a memoria reservada durante as inclusoes e nao usada
+    void indexar();
+
+    /// Algoritmo A* sobre o indice do mapa, com o custo de cada rota dado por custo(r)
+    /// e o custo futuro estimado por fator_h*(distancia em linha reta ateh o destino).
+    /// Continua a busca ateh que dest seja incluido em Fechado ou Aberto fique vazio.
+    /// Se forem fornecidos limites, retorna false quando a busca eh interrompida por
+    /// eles; a busca pode ser continuada depois por outra chamada.
+    template<class FuncaoCusto>
+    bool buscaAEstrela(BuscaAEstrela& busca, HandlePonto dest,
+                       const FuncaoCusto& custo, double fator_h,
+                       const Limites* limites = nullptr) const;
+
+    /// Refaz o caminho ateh dest encontrado pela busca. Preenche C.etapas com o caminho,
+    /// e C.acumulado com as distancias acumuladas se acumulado==true.
+    /// Retorna o custo do caminho (<0 se dest nao foi alcancado).
+    double montarCaminho(const BuscaAEstrela& busca, HandlePonto dest,
+                         CaminhoCompacto& C, bool acumulado) const;
+
+    /// Executa acao(custo, fator_h), sendo custo(r) o custo da rota r segundo os pesos
+    /// e fator_h o fator da estimativa do custo futuro pela distancia em linha reta
+    template<class Acao>
+    double comPesos(const Pesos& pesos, const Acao& acao) const;
+
+    /// Calcula o caminho de menor custo entre origem e destino, segundo os pesos,
+    /// interrompendo a busca se os limites (opcionais) forem atingidos.
+    /// Retorna o estado do termino; o custo eh C.custoTotal() (<0 se nao eh OK).
+    EstadoConsulta calcularCaminho(const IDPonto& id_origem,
+                                   const IDPonto& id_destino,
+                                   CaminhoCompacto& C, int& NA, int& NF,
+                                   const Pesos& pesos, const Limites* limites,
+                                   bool acumulado) const;
+
+    /// Ordem de importancia dos pontos para a construcao dos rotulos de hubs
+    std::vector<HandlePonto> ordemRotulos() const;
+    /// Distancia entre dois pontos pela intersecao dos rotulos de hubs
+    /// (<0 se nao existe caminho). Os rotulos devem ter sido construidos.
+    double distanciaRotulos(HandlePonto orig, HandlePonto dest) const;
+
+    /// Custos dos caminhos de menor custo entre todos os pares de pontos fornecidos:
+    /// D[i*N+j], sendo N o numero de pontos, que devem estar no mesmo componente conexo
+    void custosEntre(const std::vector<HandlePonto>& pts, const Pesos& pesos,
+                     unsigned num_threads, std::vector<double>& D) const;
+
+    friend class SessaoOrigem;
 
 public:
     /// Cria um mapa vazio
-    Planejador(): pontos(), rotas() {}
+    Planejador(): razaoMinima{0.0, 0.0, 0.0, 0.0}, paresRotulos(0) {}
 
     /// Cria um mapa com o conteudo dos arquivos arq_pontos e arq_rotas
     Planejador(const std::string& arq_pontos,
@@ -180,6 +606,12 @@ public:
         ler(arq_pontos,arq_rotas);
     }
 
+    /// Construtores e atribuicoes por copia e por movimento
+    Planejador(const Planejador&) = default;
+    Planejador& operator=(const Planejador&) = default;
+    Planejador(Planejador&&) = default;
+    Planejador& operator=(Planejador&&) = default;
+
     /// Destrutor (nao eh obrigatorio...)
     ~Planejador()
     {
@@ -192,39 +624,693 @@ public:
     /// Testa se um mapa estah vazio
     bool empty() const
     {
-        return pontos.empty();
+        return latitude.empty();
     }
 
     /// Retorna um Ponto do mapa, passando a id como parametro.
+    /// O Ponto eh montado a partir das colunas do mapa.
     /// Se a id for inexistente, retorna um Ponto vazio.
     Ponto getPonto(const IDPonto& Id) const; // incompleta
 
     /// Retorna um Rota do mapa, passando a id como parametro.
+    /// A Rota eh montada a partir das colunas do mapa.
     /// Se a id for inexistente, retorna um Rota vazio.
     Rota getRota(const IDRota& Id) const; // incompleta
 
+    /// Numero de pontos e de rotas do mapa
+    int numPontos() const
+    {
+        return latitude.size();
+    }
+    int numRotas() const
+    {
+        return comprimento.size();
+    }
+
+    /// Retorna o handle de um ponto ou de uma rota, passando a id como parametro.
+    /// Se a id for inexistente, retorna HANDLE_NULO.
+    HandlePonto getHandle(const IDPonto& Id) const;
+    HandleRota getHandle(const IDRota& Id) const;
+
+    /// Acesso em O(1) aos dados de um ponto, passando um handle valido.
+    /// Os textos sao validos enquanto o mapa nao for alterado.
+    std::string_view idPonto(HandlePonto h) const
+    {
+        return idsPontos[h];
+    }
+    std::string_view nomePonto(HandlePonto h) const
+    {
+        return nomes[indNomePonto[h]];
+    }
+
+    /// Acesso em O(1) aos dados de uma rota, passando um handle valido.
+    /// Os textos sao validos enquanto o mapa nao for alterado.
+    std::string_view idRota(HandleRota h) const
+    {
+        return idsRotas[h];
+    }
+    std::string_view nomeRota(HandleRota h) const
+    {
+        return nomes[indNomeRota[h]];
+    }
+    /// Extremidade i (0 ou 1) de uma rota
+    HandlePonto extremidadeRota(HandleRota h, int i) const
+    {
+        return extremidade[i][h];
+    }
+    double comprimentoRota(HandleRota h) const
+    {
+        return comprimento[h];
+    }
+    double tempoRota(HandleRota h) const
+    {
+        return (tempo.empty() ? 0.0 : tempo[h]);
+    }
+    double pedagioRota(HandleRota h) const
+    {
+        return (pedagio.empty() ? 0.0 : pedagio[h]);
+    }
+    int classeRota(HandleRota h) const
+    {
+        return (classe.empty() ? 0 : classe[h]);
+    }
+
+    /// Numero de componentes conexos do mapa
+    int numComponentes() const
+    {
+        return componentes.size();
+    }
+    /// Indice (de 0 a numComponentes()-1) do componente conexo de um ponto, passando um handle valido
+    int getComponente(HandlePonto h) const
+    {
+        return componente[h];
+    }
+    /// Dados dos componentes conexos, na ordem do primeiro ponto de cada um
+    const std::vector<Componente>& getComponentes() const
+    {
+        return componentes;
+    }
+
+    /// Constroi o indice de rotulos de hubs, que responde a distancia (comprimento do
+    /// caminho mais curto) entre dois pontos pela intersecao dos seus rotulos.
+    /// Usa o algoritmo de rotulacao por marcos podada (pruned landmark labeling),
+    /// processando os pontos em uma ordem de dissecao aninhada geografica.
+    /// Os rotulos sao comprimidos (hubs por diferencas, distancias em float): as
+    /// distancias calculadas pelos rotulos tem erro relativo menor que 1e-7.
+    /// O indice eh descartado quando o mapa eh alterado.
+    void construirRotulos();
+    /// Testa se o indice de rotulos de hubs foi construido
+    bool temRotulos() const
+    {
+        return !inicioRotulo.empty();
+    }
+    /// Numero total de pares (hub, distancia) nos rotulos
+    /// (0 se o indice nao foi construido)
+    size_t tamanhoRotulos() const
+    {
+        return (temRotulos() ? paresRotulos : 0);
+    }
+    /// Memoria ocupada pelo indice de rotulos de hubs (em bytes)
+    size_t memoriaRotulos() const
+    {
+        return inicioRotulo.size()*sizeof(uint64_t) + rotulos.size();
+    }
+
+    /// Calcula apenas a distancia (comprimento do caminho mais curto) entre origem e destino.
+    /// Usa os rotulos de hubs, se construidos (erro relativo menor que 1e-7);
+    /// senao, o algoritmo A*.
+    /// Retorna <0 se parametros invalidos ou se nao existe caminho.
+    double calculaDistancia(const IDPonto& id_origem,
+                            const IDPonto& id_destino) const;
+
+    /// Memoria ocupada pelo mapa e pelo seu indice, sem os rotulos de hubs (em bytes)
+    size_t memoriaMapa() const;
+
     /// Imprime o mapa no console
     void imprimirPontos() const;
     void imprimirRotas() const;
+    /// Imprime os componentes conexos do mapa no console, do maior para o menor
+    void imprimirComponentes() const;
 
     /// Leh um mapa dos arquivos arq_pontos e arq_rotas.
+    /// O arquivo de rotas pode ter, apos o comprimento, as colunas opcionais
+    /// Tempo, Pedagio e Classe, nessa ordem (o cabecalho indica quantas existem).
     /// Caso nao consiga ler dos arquivos, deixa o mapa inalterado e retorna false.
     /// Retorna true em caso de leitura bem sucedida.
     bool ler(const std::string& arq_pontos,
              const std::string& arq_rotas); // incompleta
 
+    /// Leh um mapa dos arquivos arq_pontos e arq_rotas usando varias threads.
+    /// Cada arquivo eh dividido em trechos alinhados com o fim das linhas, que sao
+    /// lidos em paralelo, inclusive a busca das extremidades das rotas. Os itens lidos
+    /// sao incluidos no mapa na ordem do arquivo, o que verifica as ids repetidas.
+    /// Produz o mesmo mapa e os mesmos codigos de erro que ler(), desde que cada
+    /// ponto ou rota ocupe uma linha do arquivo.
+    /// num_threads==0 usa o numero de nucleos da maquina.
+    bool lerParalelo(const std::string& arq_pontos,
+                     const std::string& arq_rotas,
+                     unsigned num_threads = 0);
+
     /// Calcula o caminho mais curto no mapa entre origem e destino, usando o algoritmo A*
     /// Retorna o comprimento do caminho encontrado.
     /// (<0 se parametros invalidos ou se nao existe caminho).
     /// O parametro C retorna o caminho encontrado
     /// (vazio se parametros invalidos ou se nao existe caminho).
     /// O parametro NA retorna o numero de nos em aberto ao termino do algoritmo A*
-    /// (<0 se parametros invalidos, retorna >0 mesmo quando nao existe caminho).
+    /// (<0 se parametros invalidos, retorna >0 mesmo quando nao existe caminho,
+    /// exceto se origem e destino estao em componentes conexos diferentes).
     /// O parametro NF retorna o numero de nos em fechado ao termino do algoritmo A*
-    /// (<0 se parametros invalidos, retorna >0 mesmo quando nao existe caminho).
+    /// (<0 se parametros invalidos, retorna >0 mesmo quando nao existe caminho,
+    /// exceto se origem e destino estao em componentes conexos diferentes).
+    /// Se origem e destino estao em componentes diferentes, o algoritmo A* nem eh
+    /// executado: retorna -1 com C vazio e NA == NF == 0.
     double calculaCaminho(const IDPonto& id_origem,
                           const IDPonto& id_destino,
                           Caminho& C, int& NA, int& NF); // incompleta
+
+    /// Calcula o caminho mais curto, como acima, retornando um CaminhoCompacto.
+    /// Se acumulado==true, o caminho tambem guarda a distancia acumulada em cada etapa.
+    /// Pode ser chamada simultaneamente por varias threads.
+    double calculaCaminho(const IDPonto& id_origem,
+                          const IDPonto& id_destino,
+                          CaminhoCompacto& C, int& NA, int& NF,
+                          bool acumulado = false) const;
+
+    /// Calcula o caminho de menor custo, segundo os pesos fornecidos, usando o algoritmo A*.
+    /// A estimativa do custo futuro eh a distancia em linha reta ateh o destino
+    /// multiplicada pelo menor custo por km em linha reta das rotas do mapa.
+    /// Retorna o custo do caminho encontrado (<0 se parametros invalidos, inclusive
+    /// pesos negativos, ou se nao existe caminho); C.comprimento() eh o seu comprimento.
+    /// NA e NF como acima.
+    double calculaCaminho(const IDPonto& id_origem,
+                          const IDPonto& id_destino,
+                          CaminhoCompacto& C, int& NA, int& NF,
+                          const Pesos& pesos, bool acumulado = false) const;
+
+    /// Calcula o caminho de menor custo, como acima, respeitando os limites da consulta:
+    /// a busca eh interrompida se o prazo terminar ou se a consulta for cancelada.
+    /// Retorna o estado do termino da consulta, que distingue parametros invalidos,
+    /// inexistencia de caminho e interrupcao (EXPIRADA ou CANCELADA).
+    /// O custo eh C.custoTotal() (<0 se o estado nao for OK). NA e NF como acima
+    /// (no caso de interrupcao, os numeros de nohs no momento em que ocorreu).
+    /// Pode ser chamada simultaneamente por varias threads.
+    EstadoConsulta calculaCaminho(const IDPonto& id_origem,
+                                  const IDPonto& id_destino,
+                                  CaminhoCompacto& C, int& NA, int& NF,
+                                  const Pesos& pesos, const Limites& limites,
+                                  bool acumulado = false) const;
+
+    /// Calcula um itinerario que parte da origem, passa por todas as paradas e termina
+    /// em id_fim (se id_fim for uma id valida) ou na ultima parada visitada.
+    /// Os custos entre todos os pares de pontos sao calculados em paralelo por
+    /// num_threads threads (0 usa o numero de nucleos da maquina), por buscas de
+    /// Dijkstra ou, se soh o comprimento importa e os rotulos de hubs foram construidos,
+    /// pelos rotulos. A ordem das paradas eh escolhida pela heuristica da insercao do
+    /// mais proximo, melhorada por 2-opt e Or-opt, e o caminho de cada trecho eh
+    /// calculado pelo algoritmo A*.
+    /// Retorna o custo total do itinerario, segundo os pesos (<0 se parametros invalidos
+    /// ou se alguma parada estah em outro componente conexo); I.comprimento() eh o
+    /// seu comprimento. O parametro I retorna o itinerario (vazio se nao existe).
+    double calculaItinerario(const IDPonto& id_origem,
+                             const std::vector<IDPonto>& paradas,
+                             const IDPonto& id_fim, Itinerario& I,
+                             const Pesos& pesos = Pesos(),
+                             unsigned num_threads = 0) const;
+    /// Calcula um itinerario, como acima, sem ponto final fixo
+    double calculaItinerario(const IDPonto& id_origem,
+                             const std::vector<IDPonto>& paradas,
+                             Itinerario& I, const Pesos& pesos = Pesos(),
+                             unsigned num_threads = 0) const;
+};
+
+/* **************************
+   * CLASSE CAMINHOCOMPACTO *
+   ************************** */
+
+/// Uma etapa de um CaminhoCompacto: handles da rota e do ponto
+struct Etapa
+{
+    HandleRota rota;   // Rota que trouxe da etapa anterior (HANDLE_NULO na origem)
+    HandlePonto ponto; // Ponto alcancado
+
+    Etapa(HandleRota r=HANDLE_NULO, HandlePonto p=HANDLE_NULO): rota(r), ponto(p) {}
+};
+
+/// Os dados de uma etapa de um CaminhoCompacto, obtidos em O(1) pelos handles.
+/// Os textos sao validos enquanto o mapa nao for alterado.
+struct DadosEtapa
+{
+    const Etapa& etapa;
+    const Planejador& mapa;
+    double acumulado; // Distancia acumulada ateh o ponto (<0 se nao calculada)
+
+    bool origem() const
+    {
+        return etapa.rota == HANDLE_NULO;
+    }
+    // Na origem nao ha rota: id e nome vazios e comprimento nulo
+    std::string_view idRota() const
+    {
+        return (origem() ? std::string_view() : mapa.idRota(etapa.rota));
+    }
+    std::string_view nomeRota() const
+    {
+        return (origem() ? std::string_view() : mapa.nomeRota(etapa.rota));
+    }
+    double comprimento() const
+    {
+        return (origem() ? 0.0 : mapa.comprimentoRota(etapa.rota));
+    }
+    std::string_view idPonto() const
+    {
+        return mapa.idPonto(etapa.ponto);
+    }
+    std::string_view nomePonto() const
+    {
+        return mapa.nomePonto(etapa.ponto);
+    }
+};
+
+/// Um caminho encontrado entre dois pontos, em representacao compacta:
+/// um vetor de etapas <HandleRota,HandlePonto>, com a mesma organizacao do Caminho.
+/// Guarda o comprimento e o custo totais e, opcionalmente, as distancias acumuladas.
+/// So pode ser usado enquanto o mapa que o calculou nao for alterado.
+class CaminhoCompacto
+{
+private:
+    const Planejador* mapa;         // O mapa em que o caminho foi calculado
+    std::vector<Etapa> etapas;      // As etapas, da origem ao destino
+    std::vector<double> acumulado;  // Distancia acumulada em cada etapa (vazio se nao calculada)
+    double compr;                   // Comprimento total (<0 se nao ha caminho)
+    double custo;                   // Custo total, segundo os pesos usados (<0 se nao ha caminho)
+
+    friend class Planejador;
+    friend class SessaoOrigem;
+
+public:
+    /// Cria um caminho vazio
+    CaminhoCompacto(): mapa(nullptr), etapas(), acumulado(), compr(-1.0), custo(-1.0) {}
+
+    /// Torna o caminho vazio
+    void clear()
+    {
+        etapas.clear();
+        acumulado.clear();
+        compr = -1.0;
+        custo = -1.0;
+    }
+
+    /// Numero de etapas (incluindo a origem)
+    size_t size() const
+    {
+        return etapas.size();
+    }
+    bool empty() const
+    {
+        return etapas.empty();
+    }
+    /// Comprimento total do caminho (<0 se nao ha caminho)
+    double comprimento() const
+    {
+        return compr;
+    }
+    /// Custo total do caminho, segundo os pesos usados no calculo (<0 se nao ha caminho)
+    double custoTotal() const
+    {
+        return custo;
+    }
+    /// Testa se as distancias acumuladas foram calculadas
+    bool temAcumulado() const
+    {
+        return !acumulado.empty();
+    }
+    /// As etapas, como handles
+    const std::vector<Etapa>& getEtapas() const
+    {
+        return etapas;
+    }
+
+    /// Iterador que percorre as etapas retornando os seus dados (DadosEtapa)
+    class const_iterator
+    {
+    private:
+        const CaminhoCompacto* C;
+        size_t i;
+    public:
+        /// Os dados sao montados a cada acesso: operator-> retorna este objeto,
+        /// que guarda os dados e age como um ponteiro para eles
+        struct ponteiro
+        {
+            DadosEtapa dados;
+            const DadosEtapa* operator->() const
+            {
+                return &dados;
+            }
+        };
+
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = DadosEtapa;
+        using difference_type = std::ptrdiff_t;
+        using pointer = ponteiro;
+        using reference = DadosEtapa;
+
+        const_iterator(const CaminhoCompacto* C0=nullptr, size_t i0=0): C(C0), i(i0) {}
+
+        DadosEtapa operator*() const
+        {
+            return DadosEtapa{C->etapas[i], *C->mapa,
+                              (C->acumulado.empty() ? -1.0 : C->acumulado[i])};
+        }
+        ponteiro operator->() const
+        {
+            return ponteiro{**this};
+        }
+        DadosEtapa operator[](difference_type n) const
+        {
+            return *(*this + n);
+        }
+        const_iterator& operator++()
+        {
+            ++i;
+            return *this;
+        }
+        const_iterator operator++(int)
+        {
+            const_iterator prov(*this);
+            ++i;
+            return prov;
+        }
+        const_iterator& operator--()
+        {
+            --i;
+            return *this;
+        }
+        const_iterator operator--(int)
+        {
+            const_iterator prov(*this);
+            --i;
+            return prov;
+        }
+        const_iterator& operator+=(difference_type n)
+        {
+            i += n;
+            return *this;
+        }
+        const_iterator& operator-=(difference_type n)
+        {
+            i -= n;
+            return *this;
+        }
+        const_iterator operator+(difference_type n) const
+        {
+            return const_iterator(C, i+n);
+        }
+        const_iterator operator-(difference_type n) const
+        {
+            return const_iterator(C, i-n);
+        }
+        friend const_iterator operator+(difference_type n, const const_iterator& I)
+        {
+            return I + n;
+        }
+        difference_type operator-(const const_iterator& I) const
+        {
+            return difference_type(i) - difference_type(I.i);
+        }
+        bool operator==(const const_iterator& I) const
+        {
+            return i==I.i;
+        }
+        bool operator!=(const const_iterator& I) const
+        {
+            return i!=I.i;
+        }
+        bool operator<(const const_iterator& I) const
+        {
+            return i<I.i;
+        }
+        bool operator>(const const_iterator& I) const
+        {
+            return i>I.i;
+        }
+        bool operator<=(const const_iterator& I) const
+        {
+            return i<=I.i;
+        }
+        bool operator>=(const const_iterator& I) const
+        {
+            return i>=I.i;
+        }
+    };
+    const_iterator begin() const
+    {
+        return const_iterator(this, 0);
+    }
+    const_iterator end() const
+    {
+        return const_iterator(this, etapas.size());
+    }
+
+    /// Converte para a representacao com ids (Caminho)
+    Caminho paraCaminho() const;
+
+    /// Escreve as etapas do caminho, uma por linha, diretamente no buffer do stream X:
+    /// "De <ponto>" na origem e "Por <rota> ateh <ponto> (<comprimento>km)" nas demais
+    void escrever(std::ostream& X) const;
+};
+/* *************************
+   * CLASSE SESSAOORIGEM   *
+   ************************* */
+
+/// Uma sessao de consultas de caminhos a partir de uma mesma origem.
+/// A busca A* eh mantida de uma consulta para a outra: um destino que jah estah em
+/// Fechado eh respondido sem nova busca; senao, a busca continua de onde parou,
+/// com os nohs em Aberto reordenados pelo custo futuro ateh o novo destino.
+/// So pode ser usada enquanto o mapa nao for alterado, e por uma thread de cada vez.
+class SessaoOrigem
+{
+private:
+    const Planejador* mapa;              // O mapa das consultas
+    HandlePonto orig;                    // A origem (HANDLE_NULO se inexistente)
+    Pesos pesos;                         // Os pesos do custo das rotas
+    std::unique_ptr<BuscaAEstrela> busca; // A busca mantida entre as consultas
+
+public:
+    /// Cria uma sessao de consultas a partir de id_origem no mapa G, com os pesos P
+    SessaoOrigem(const Planejador& G, const IDPonto& id_origem, const Pesos& P = Pesos());
+    SessaoOrigem(SessaoOrigem&&) noexcept;
+    SessaoOrigem& operator=(SessaoOrigem&&) noexcept;
+    ~SessaoOrigem();
+
+    /// Testa se a origem existe no mapa
+    bool valid() const
+    {
+        return orig != HANDLE_NULO;
+    }
+
+    /// Calcula o caminho da origem ateh id_destino.
+    /// O retorno e os parametros C, NA e NF sao como em Planejador::calculaCaminho,
+    /// mas NA e NF contam os nohs de todas as consultas da sessao ateh o momento
+    /// (um destino em outro componente conexo eh rejeitado sem alterar a busca).
+    /// A primeira consulta da sessao eh identica a Planejador::calculaCaminho.
+    double calculaCaminho(const IDPonto& id_destino,
+                          CaminhoCompacto& C, int& NA, int& NF,
+                          bool acumulado = false);
+};
+
+/* *************************
+   * CLASSE ITINERARIO     *
+   ************************* */
+
+/// Um trecho de um Itinerario: o caminho de uma parada ateh a seguinte
+struct TrechoItinerario
+{
+    int parada;         // Indice da parada de destino na lista fornecida (-1 no fim fixo)
+    size_t inicio;      // Indice da etapa do caminho do itinerario em que o trecho comeca
+    size_t fim;         // Indice da etapa do caminho do itinerario em que o trecho termina
+    double comprimento; // Comprimento do trecho (em km)
+    double custo;       // Custo do trecho, segundo os pesos usados
+
+    TrechoItinerario(): parada(-1), inicio(0), fim(0), comprimento(0.0), custo(0.0) {}
+};
+
+/// Um itinerario calculado pelo Planejador: um unico caminho da origem ao fim,
+/// passando pelas paradas na ordem escolhida, dividido em um trecho por parada
+/// (mais um trecho ateh o fim fixo, se houver).
+/// So pode ser usado enquanto o mapa que o calculou nao for alterado.
+class Itinerario
+{
+private:
+    CaminhoCompacto caminho;               // O caminho completo
+    std::vector<TrechoItinerario> trechos; // Os trechos, na ordem do caminho
+
+    friend class Planejador;
+
+public:
+    /// Torna o itinerario vazio
+    void clear()
+    {
+        caminho.clear();
+        trechos.clear();
+    }
+    /// Testa se o itinerario estah vazio (parametros invalidos ou nao existe itinerario)
+    bool empty() const
+    {
+        return caminho.empty();
+    }
+    /// Caminho completo, da origem ao fim
+    const CaminhoCompacto& getCaminho() const
+    {
+        return caminho;
+    }
+    /// Trechos do itinerario, na ordem do caminho
+    const std::vector<TrechoItinerario>& getTrechos() const
+    {
+        return trechos;
+    }
+    /// Comprimento total (<0 se nao existe itinerario)
+    double comprimento() const
+    {
+        return caminho.comprimento();
+    }
+    /// Custo total, segundo os pesos usados no calculo (<0 se nao existe itinerario)
+    double custoTotal() const
+    {
+        return caminho.custoTotal();
+    }
+};
+
+/* *************************
+   * CLASSE FILABLOQUEANTE *
+   ************************* */
+
+/// Fila de itens compartilhada entre as threads que incluem e as que retiram itens,
+/// que esperam enquanto ela estiver vazia. O que acontece com os itens que restam
+/// quando a fila eh encerrada depende da forma de encerrar escolhida por quem a usa.
+template<class T>
+class FilaBloqueante
+{
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<T> fila;
+    bool fim;
+public:
+    FilaBloqueante(): mtx(), cv(), fila(), fim(false) {}
+
+    /// Inclui um item no final da fila
+    void incluir(T&& item)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            fila.push_back(std::move(item));
+        }
+        cv.notify_one();
+    }
+
+    /// Retira o primeiro item da fila, esperando se ela estiver vazia.
+    /// Retorna false quando a fila foi encerrada e nao tem mais itens.
+    bool retirar(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [this]{ return fim || !fila.empty(); });
+        if (fila.empty()) return false;
+        item = std::move(fila.front());
+        fila.pop_front();
+        return true;
+    }
+
+    /// Encerra a fila, liberando as threads que esperam por itens.
+    /// Os itens restantes continuam sendo retirados ateh a fila esvaziar.
+    void encerrar()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            fim = true;
+        }
+        cv.notify_all();
+    }
+
+    /// Encerra a fila, liberando as threads que esperam por itens.
+    /// Os itens restantes saem da fila e sao passados, fora da trava, para descartar(item).
+    template<class Descarte>
+    void encerrar(const Descarte& descartar)
+    {
+        std::deque<T> restantes;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            fim = true;
+            restantes.swap(fila);
+        }
+        cv.notify_all();
+        for (T& item : restantes) descartar(item);
+    }
+};
+
+/* ****************************
+   * CLASSE EXECUTORCONSULTAS *
+   **************************** */
+
+/// Resultado de uma consulta assincrona de caminho
+struct ResultadoConsulta
+{
+    EstadoConsulta estado;   // Estado do termino da consulta
+    CaminhoCompacto caminho; // Caminho encontrado (vazio se o estado nao for OK)
+    int NA;                  // Nohs em aberto, como em Planejador::calculaCaminho
+    int NF;                  // Nohs em fechado, como em Planejador::calculaCaminho
+
+    ResultadoConsulta(): estado(EstadoConsulta::INVALIDA), caminho(), NA(-1), NF(-1) {}
+
+    /// Custo do caminho encontrado (<0 se o estado nao for OK)
+    double custo() const
+    {
+        return caminho.custoTotal();
+    }
+};
+
+class FilaConsultas;
+
+/// Executor de consultas assincronas de caminhos em um mapa: as consultas submetidas
+/// entram em uma fila e sao calculadas, na ordem de submissao, por um conjunto fixo
+/// de threads. Cada submissao retorna um std::future com o resultado da consulta.
+/// Uma consulta cujo prazo termina ou que eh cancelada ainda na fila eh concluida sem
+/// ser calculada; durante o calculo, a busca A* verifica os limites periodicamente
+/// e a thread fica livre logo apos a interrupcao.
+/// O mapa nao pode ser alterado enquanto o executor existir.
+class ExecutorConsultas
+{
+private:
+    const Planejador* mapa;             // O mapa das consultas
+    std::unique_ptr<FilaConsultas> fila; // Consultas aguardando uma thread
+    std::vector<std::thread> threads;    // Threads de calculo
+
+    /// Thread de calculo: atende as consultas da fila ateh que ela seja encerrada
+    void trabalhar();
+
+public:
+    /// Cria um executor de consultas no mapa G com num_threads threads
+    /// (0 usa o numero de nucleos da maquina)
+    explicit ExecutorConsultas(const Planejador& G, unsigned num_threads = 0);
+    ExecutorConsultas(const ExecutorConsultas&) = delete;
+    ExecutorConsultas& operator=(const ExecutorConsultas&) = delete;
+    /// Conclui como CANCELADA as consultas ainda na fila e espera o fim das que
+    /// estao sendo calculadas
+    ~ExecutorConsultas();
+
+    /// Numero de threads de calculo
+    unsigned numThreads() const
+    {
+        return threads.size();
+    }
+
+    /// Submete uma consulta de caminho entre id_origem e id_destino, com os pesos e os
+    /// limites fornecidos (o prazo conta o tempo de espera na fila). O resultado eh o
+    /// de Planejador::calculaCaminho com limites.
+    std::future<ResultadoConsulta> submeter(const IDPonto& id_origem,
+                                            const IDPonto& id_destino,
+                                            const Pesos& pesos = Pesos(),
+                                            const Limites& limites = Limites(),
+                                            bool acumulado = false);
 };
 
 #endif // _PLANEJADOR_H_